@@ -0,0 +1,340 @@
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stdint.h>
+    #include <time.h>
+    #include <pthread.h>
+    #include <sched.h>
+
+    #include "bench.h"
+
+//********************************************************************************************************
+// Local defines
+//********************************************************************************************************
+
+    #define MIN_SIZE    16
+    #define MAX_SIZE    64
+
+//  number of timed free+alloc pairs at each live allocation count
+    #define CHURN_OPS   2000
+
+//  live allocations held by each thread, and the free+alloc pairs each thread makes, for the thread safe configurations
+    #define THREAD_LIVE_COUNT   1000
+    #define THREAD_OPS          200000
+    #define MAX_THREADS         8
+
+//  allocations freed and replaced by each call of heaps_free_batch() and heaps_alloc_batch()
+    #define BATCH_SIZE          32
+
+//  allocations in flight between each producer and consumer thread
+    #define PIPE_SIZE           256
+
+//  allocations passed from a producer thread to a consumer thread, which frees them
+    typedef struct pipe_t
+    {
+        const bench_heaps_t* heaps;
+        void* ring[PIPE_SIZE];
+        unsigned head;      // written by the producer, accessed atomically
+        unsigned tail;      // written by the consumer, accessed atomically
+    } pipe_t;
+
+//********************************************************************************************************
+// Private variables
+//********************************************************************************************************
+
+    static const bench_heaps_t* const configurations[] = {&bench_heaps_list, &bench_heaps_dlist, &bench_heaps_hash, &bench_heaps_slab, &bench_heaps_sampling};
+
+    static const int live_counts[] = {1000, 100000, 1000000};
+
+    static const bench_heaps_t* const threaded_configurations[] = {&bench_heaps_locked, &bench_heaps_shards, &bench_heaps_per_thread, &bench_heaps_per_thread_cache};
+
+    static const int thread_counts[] = {1, 2, 4, MAX_THREADS};
+
+//********************************************************************************************************
+// Private prototypes
+//********************************************************************************************************
+
+//  With live_count allocations made, free and replace CHURN_OPS random allocations.
+//  Return the average time in ns for each free+alloc pair.
+    static double churn(const bench_heaps_t* heaps, int live_count);
+
+//  Run thread_count threads each making THREAD_OPS free+alloc pairs from their own THREAD_LIVE_COUNT allocations.
+//  Return the total free+alloc pairs per second.
+    static double threaded_churn(const bench_heaps_t* heaps, int thread_count);
+    static void* thread_churn(void* arg);
+
+//  As threaded_churn(), but freeing and replacing BATCH_SIZE consecutive allocations at a time with the batch functions.
+    static double threaded_batch_churn(const bench_heaps_t* heaps, int thread_count);
+    static void* thread_batch_churn(void* arg);
+
+//  Run thread_count/2 producer threads each making THREAD_OPS allocations, which are freed by a consumer thread each.
+//  Return the total alloc+free pairs per second.
+    static double pipeline(const bench_heaps_t* heaps, int thread_count);
+    static void* producer(void* arg);
+    static void* consumer(void* arg);
+
+    static double now_ns(void);
+
+//********************************************************************************************************
+// Public functions
+//********************************************************************************************************
+
+int main(int argc, const char* argv[])
+{
+    (void)argc;(void)argv;
+    int i,j;
+
+    printf("\nAverage time for a heaps_free() of a random live allocation, plus a heaps_alloc() to replace it\n\n");
+    printf("%24s", "live allocations:");
+    for(j=0; j != sizeof(live_counts)/sizeof(*live_counts); j++)
+        printf("%12i", live_counts[j]);
+    printf("\n");
+
+    for(i=0; i != sizeof(configurations)/sizeof(*configurations); i++)
+    {
+        printf("%24s", configurations[i]->name);
+        for(j=0; j != sizeof(live_counts)/sizeof(*live_counts); j++)
+        {
+            printf("%10.0fns", churn(configurations[i], live_counts[j]));
+            fflush(stdout);
+        };
+        printf("\n");
+    };
+    printf("\n");
+
+    printf("\nFree+alloc pairs per second, from all threads, with each thread freeing and replacing it's own allocations\n\n");
+    printf("%24s", "threads:");
+    for(j=0; j != sizeof(thread_counts)/sizeof(*thread_counts); j++)
+        printf("%12i", thread_counts[j]);
+    printf("\n");
+
+    for(i=0; i != sizeof(threaded_configurations)/sizeof(*threaded_configurations); i++)
+    {
+        printf("%24s", threaded_configurations[i]->name);
+        for(j=0; j != sizeof(thread_counts)/sizeof(*thread_counts); j++)
+        {
+            printf("%11.2fM", threaded_churn(threaded_configurations[i], thread_counts[j]) / 1e6);
+            fflush(stdout);
+        };
+        printf("\n");
+    };
+    printf("\n");
+
+    printf("\nAs above, but each thread frees and replaces %i allocations at a time with heaps_free_batch() and heaps_alloc_batch()\n\n", BATCH_SIZE);
+    printf("%24s", "threads:");
+    for(j=0; j != sizeof(thread_counts)/sizeof(*thread_counts); j++)
+        printf("%12i", thread_counts[j]);
+    printf("\n");
+
+    for(i=0; i != sizeof(threaded_configurations)/sizeof(*threaded_configurations); i++)
+    {
+        printf("%24s", threaded_configurations[i]->name);
+        for(j=0; j != sizeof(thread_counts)/sizeof(*thread_counts); j++)
+        {
+            printf("%11.2fM", threaded_batch_churn(threaded_configurations[i], thread_counts[j]) / 1e6);
+            fflush(stdout);
+        };
+        printf("\n");
+    };
+    printf("\n");
+
+    printf("\nAlloc+free pairs per second, from all threads, with each allocation made by a producer thread and freed by a consumer thread\n\n");
+    printf("%24s", "threads:");
+    for(j=1; j != sizeof(thread_counts)/sizeof(*thread_counts); j++)
+        printf("%12i", thread_counts[j]);
+    printf("\n");
+
+    for(i=0; i != sizeof(threaded_configurations)/sizeof(*threaded_configurations); i++)
+    {
+        printf("%24s", threaded_configurations[i]->name);
+        for(j=1; j != sizeof(thread_counts)/sizeof(*thread_counts); j++)
+        {
+            printf("%11.2fM", pipeline(threaded_configurations[i], thread_counts[j]) / 1e6);
+            fflush(stdout);
+        };
+        printf("\n");
+    };
+    printf("\n");
+
+    return 0;
+}
+
+//********************************************************************************************************
+// Private functions
+//********************************************************************************************************
+
+static double churn(const bench_heaps_t* heaps, int live_count)
+{
+    void** live = malloc(live_count * sizeof(void*));
+    double start;
+    double elapsed;
+    int i;
+    int victim;
+
+    srand(1);
+    for(i=0; i != live_count; i++)
+        live[i] = heaps->alloc(MIN_SIZE + rand() % (MAX_SIZE-MIN_SIZE));
+
+    start = now_ns();
+    for(i=0; i != CHURN_OPS; i++)
+    {
+        victim = rand() % live_count;
+        heaps->free(live[victim]);
+        live[victim] = heaps->alloc(MIN_SIZE + rand() % (MAX_SIZE-MIN_SIZE));
+    };
+    elapsed = now_ns() - start;
+
+    // free the most recent allocations first, this is O(1) for every configuration
+    while(live_count--)
+        heaps->free(live[live_count]);
+    free(live);
+
+    return elapsed / CHURN_OPS;
+}
+
+static double threaded_churn(const bench_heaps_t* heaps, int thread_count)
+{
+    pthread_t threads[MAX_THREADS];
+    double start;
+    double elapsed;
+    int i;
+
+    start = now_ns();
+    for(i=0; i != thread_count; i++)
+        pthread_create(&threads[i], NULL, thread_churn, (void*)heaps);
+    for(i=0; i != thread_count; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+
+    return (double)thread_count * THREAD_OPS / (elapsed / 1e9);
+}
+
+static void* thread_churn(void* arg)
+{
+    const bench_heaps_t* heaps = arg;
+    void* live[THREAD_LIVE_COUNT];
+    unsigned seed = (unsigned)(uintptr_t)live;
+    int victim;
+    int i;
+
+    for(i=0; i != THREAD_LIVE_COUNT; i++)
+        live[i] = heaps->alloc(MIN_SIZE + rand_r(&seed) % (MAX_SIZE-MIN_SIZE));
+
+    for(i=0; i != THREAD_OPS; i++)
+    {
+        victim = rand_r(&seed) % THREAD_LIVE_COUNT;
+        heaps->free(live[victim]);
+        live[victim] = heaps->alloc(MIN_SIZE + rand_r(&seed) % (MAX_SIZE-MIN_SIZE));
+    };
+
+    for(i=0; i != THREAD_LIVE_COUNT; i++)
+        heaps->free(live[i]);
+
+    return NULL;
+}
+
+static double threaded_batch_churn(const bench_heaps_t* heaps, int thread_count)
+{
+    pthread_t threads[MAX_THREADS];
+    double start;
+    double elapsed;
+    int i;
+
+    start = now_ns();
+    for(i=0; i != thread_count; i++)
+        pthread_create(&threads[i], NULL, thread_batch_churn, (void*)heaps);
+    for(i=0; i != thread_count; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+
+    return (double)thread_count * THREAD_OPS / (elapsed / 1e9);
+}
+
+static void* thread_batch_churn(void* arg)
+{
+    const bench_heaps_t* heaps = arg;
+    void* live[THREAD_LIVE_COUNT];
+    size_t sizes[THREAD_LIVE_COUNT];
+    unsigned seed = (unsigned)(uintptr_t)live;
+    int first;
+    int i;
+
+    for(i=0; i != THREAD_LIVE_COUNT; i++)
+        sizes[i] = MIN_SIZE + rand_r(&seed) % (MAX_SIZE-MIN_SIZE);
+    heaps->alloc_batch(sizes, THREAD_LIVE_COUNT, live);
+
+    for(i=0; i != THREAD_OPS/BATCH_SIZE; i++)
+    {
+        first = rand_r(&seed) % (THREAD_LIVE_COUNT-BATCH_SIZE);
+        heaps->free_batch(&live[first], BATCH_SIZE);
+        heaps->alloc_batch(&sizes[first], BATCH_SIZE, &live[first]);
+    };
+
+    heaps->free_batch(live, THREAD_LIVE_COUNT);
+
+    return NULL;
+}
+
+static double pipeline(const bench_heaps_t* heaps, int thread_count)
+{
+    pthread_t threads[MAX_THREADS];
+    static pipe_t pipes[MAX_THREADS/2];
+    double start;
+    double elapsed;
+    int i;
+
+    start = now_ns();
+    for(i=0; i != thread_count/2; i++)
+    {
+        pipes[i] = (pipe_t){.heaps = heaps};
+        pthread_create(&threads[i*2], NULL, producer, &pipes[i]);
+        pthread_create(&threads[i*2+1], NULL, consumer, &pipes[i]);
+    };
+    for(i=0; i != thread_count/2*2; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+
+    return (double)(thread_count/2) * THREAD_OPS / (elapsed / 1e9);
+}
+
+static void* producer(void* arg)
+{
+    pipe_t* pipe = arg;
+    unsigned seed = (unsigned)(uintptr_t)pipe;
+    unsigned head;
+    int i;
+
+    for(i=0; i != THREAD_OPS; i++)
+    {
+        head = __atomic_load_n(&pipe->head, __ATOMIC_RELAXED);
+        while(head - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) == PIPE_SIZE)
+            sched_yield();
+        pipe->ring[head % PIPE_SIZE] = pipe->heaps->alloc(MIN_SIZE + rand_r(&seed) % (MAX_SIZE-MIN_SIZE));
+        __atomic_store_n(&pipe->head, head+1, __ATOMIC_RELEASE);
+    };
+    return NULL;
+}
+
+static void* consumer(void* arg)
+{
+    pipe_t* pipe = arg;
+    unsigned tail;
+    int i;
+
+    for(i=0; i != THREAD_OPS; i++)
+    {
+        tail = __atomic_load_n(&pipe->tail, __ATOMIC_RELAXED);
+        while(tail == __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE))
+            sched_yield();
+        pipe->heaps->free(pipe->ring[tail % PIPE_SIZE]);
+        __atomic_store_n(&pipe->tail, tail+1, __ATOMIC_RELEASE);
+    };
+    return NULL;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
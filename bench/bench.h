@@ -0,0 +1,35 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+    #include <stddef.h>
+
+//********************************************************************************************************
+// Public defines
+//********************************************************************************************************
+
+//	Each heaps configuration under test is built in it's own source file with HEAPS_SANDBOX,
+//	and exposes it's allocator through one of these.
+    typedef struct bench_heaps_t
+    {
+        const char* name;
+        void* (*alloc)(size_t size);
+        void (*free)(void* ptr);
+        size_t (*alloc_batch)(const size_t* sizes, size_t n, void** ptrs);	// NULL unless the configuration is in the threaded tables
+        void (*free_batch)(void** ptrs, size_t n);
+    } bench_heaps_t;
+
+//********************************************************************************************************
+// Public variables
+//********************************************************************************************************
+
+    extern const bench_heaps_t bench_heaps_list;		// default singly linked list
+    extern const bench_heaps_t bench_heaps_dlist;		// HEAPS_DOUBLY_LINKED
+    extern const bench_heaps_t bench_heaps_hash;		// HEAPS_HASH_TABLE
+    extern const bench_heaps_t bench_heaps_slab;		// HEAPS_DOUBLY_LINKED and HEAPS_SLAB
+    extern const bench_heaps_t bench_heaps_sampling;	// HEAPS_SAMPLING
+    extern const bench_heaps_t bench_heaps_locked;		// HEAPS_DOUBLY_LINKED with a pthread mutex
+    extern const bench_heaps_t bench_heaps_shards;		// HEAPS_DOUBLY_LINKED and HEAPS_SHARDS with a pthread mutex per shard
+    extern const bench_heaps_t bench_heaps_per_thread;	// HEAPS_PER_THREAD
+    extern const bench_heaps_t bench_heaps_per_thread_cache;	// HEAPS_PER_THREAD and HEAPS_THREAD_CACHE
+
+#endif
@@ -0,0 +1,44 @@
+// *************************************
+//  heaps.h configured as: doubly linked list, with one mutex for every thread
+
+    #include <stdlib.h>
+    #include <pthread.h>
+    #include "bench.h"
+
+    #define HEAPS_SANDBOX
+    #define HEAPS_NO_PRE_OPERATION_WALK_CHECK
+    #define HEAPS_DOUBLY_LINKED
+    #define HEAPS_ATOMIC_STATS
+
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    #define heaps_platform_free(ptr)            free(ptr)
+    #define heaps_platform_alloc(size)          malloc(size)
+    #define heaps_platform_realloc(ptr, size)   realloc(ptr, size)
+    #define heaps_platform_lock()               pthread_mutex_lock(&lock)
+    #define heaps_platform_unlock()             pthread_mutex_unlock(&lock)
+
+    #define HEAPS_IMPLEMENTATION
+    #include "../heaps.h"
+
+static void* bench_alloc(size_t size)
+{
+    return heaps_alloc(size);
+}
+
+static void bench_free(void* ptr)
+{
+    heaps_free(ptr);
+}
+
+static size_t bench_alloc_batch(const size_t* sizes, size_t n, void** ptrs)
+{
+    return heaps_alloc_batch(sizes, n, ptrs);
+}
+
+static void bench_free_batch(void** ptrs, size_t n)
+{
+    heaps_free_batch(ptrs, n);
+}
+
+const bench_heaps_t bench_heaps_locked = {"single lock", bench_alloc, bench_free, bench_alloc_batch, bench_free_batch};
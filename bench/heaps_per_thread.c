@@ -0,0 +1,37 @@
+// *************************************
+//  heaps.h configured as: a list per thread, with frees from other threads queued to the owner
+
+    #include <stdlib.h>
+    #include "bench.h"
+
+    #define HEAPS_SANDBOX
+    #define HEAPS_PER_THREAD    64
+
+    #define heaps_platform_free(ptr)            free(ptr)
+    #define heaps_platform_alloc(size)          malloc(size)
+    #define heaps_platform_realloc(ptr, size)   realloc(ptr, size)
+
+    #define HEAPS_IMPLEMENTATION
+    #include "../heaps.h"
+
+static void* bench_alloc(size_t size)
+{
+    return heaps_alloc(size);
+}
+
+static void bench_free(void* ptr)
+{
+    heaps_free(ptr);
+}
+
+static size_t bench_alloc_batch(const size_t* sizes, size_t n, void** ptrs)
+{
+    return heaps_alloc_batch(sizes, n, ptrs);
+}
+
+static void bench_free_batch(void** ptrs, size_t n)
+{
+    heaps_free_batch(ptrs, n);
+}
+
+const bench_heaps_t bench_heaps_per_thread = {"per thread", bench_alloc, bench_free, bench_alloc_batch, bench_free_batch};
@@ -0,0 +1,43 @@
+// *************************************
+//  heaps.h configured as: doubly linked list, split between shards each with it's own mutex
+
+    #include <stdlib.h>
+    #include <pthread.h>
+    #include "bench.h"
+
+    #define HEAPS_SANDBOX
+    #define HEAPS_DOUBLY_LINKED
+    #define HEAPS_SHARDS    16
+
+    static pthread_mutex_t locks[HEAPS_SHARDS] = {[0 ... HEAPS_SHARDS-1] = PTHREAD_MUTEX_INITIALIZER};
+
+    #define heaps_platform_free(ptr)            free(ptr)
+    #define heaps_platform_alloc(size)          malloc(size)
+    #define heaps_platform_realloc(ptr, size)   realloc(ptr, size)
+    #define heaps_platform_shard_lock(i)        pthread_mutex_lock(&locks[i])
+    #define heaps_platform_shard_unlock(i)      pthread_mutex_unlock(&locks[i])
+
+    #define HEAPS_IMPLEMENTATION
+    #include "../heaps.h"
+
+static void* bench_alloc(size_t size)
+{
+    return heaps_alloc(size);
+}
+
+static void bench_free(void* ptr)
+{
+    heaps_free(ptr);
+}
+
+static size_t bench_alloc_batch(const size_t* sizes, size_t n, void** ptrs)
+{
+    return heaps_alloc_batch(sizes, n, ptrs);
+}
+
+static void bench_free_batch(void** ptrs, size_t n)
+{
+    heaps_free_batch(ptrs, n);
+}
+
+const bench_heaps_t bench_heaps_shards = {"16 shards", bench_alloc, bench_free, bench_alloc_batch, bench_free_batch};
@@ -0,0 +1,29 @@
+// *************************************
+//  heaps.h configured as: doubly linked list, with small blocks from size classes
+
+    #include <stdlib.h>
+    #include "bench.h"
+
+    #define HEAPS_SANDBOX
+    #define HEAPS_NO_PRE_OPERATION_WALK_CHECK
+    #define HEAPS_DOUBLY_LINKED
+    #define HEAPS_SLAB
+
+    #define heaps_platform_free(ptr)            free(ptr)
+    #define heaps_platform_alloc(size)          malloc(size)
+    #define heaps_platform_realloc(ptr, size)   realloc(ptr, size)
+
+    #define HEAPS_IMPLEMENTATION
+    #include "../heaps.h"
+
+static void* bench_alloc(size_t size)
+{
+    return heaps_alloc(size);
+}
+
+static void bench_free(void* ptr)
+{
+    heaps_free(ptr);
+}
+
+const bench_heaps_t bench_heaps_slab = {"doubly linked + slab", bench_alloc, bench_free, NULL, NULL};
@@ -44,6 +44,199 @@ If you do not want this to happen (due to the performance hit), then define the
 	#define HEAPS_NO_PRE_OPERATION_WALK_CHECK
 	Note that even if you define this, heaps_platform_check() will still be called if it has been provided.
 
+To bound the time taken by the pre-operation walk, it can be spread over many operations by defining the symbol:
+	#define HEAPS_WALK_CHECK_BUDGET	<K>
+	Each operation then checks at most K allocations, resuming from where the previous operation stopped.
+	The count is checked at the end of each pass, allowing for allocations linked and unlinked while the pass was in progress.
+	heaps_get_walk_pass_count() returns the number of passes completed.
+	If HEAPS_HEADER_CHECKSUM is also defined, the walk is done again, and verifies the checksum of every allocation it visits.
+
+To call heaps_platform_check() only on every Nth operation, define the symbol:
+	#define HEAPS_PLATFORM_CHECK_INTERVAL	<N>
+
+The checks can also be done away from the allocating code, by calling heaps_check_step() (from an idle loop for example).
+Each call takes the lock once, continues the walk by HEAPS_WALK_CHECK_BUDGET allocations (or walks them all), and calls heaps_platform_check().
+If a problem is found, the error handler is called with the file:line of the last intact allocation visited before it.
+
+On platforms with pthreads, heaps can do this continuously on it's own thread, if you define the symbol:
+	#define HEAPS_CHECKER_THREAD
+	Then heaps_checker_start(interval_us) starts a thread calling heaps_check_step() every interval_us, and heaps_checker_stop() stops it.
+	No checks are done by the allocating threads, so they are never slowed by them. heaps_platform_lock() must provide real mutual exclusion.
+	Define HEAPS_WALK_CHECK_BUDGET too, so that the checker only holds the lock briefly.
+
+To stop every thread contending for heaps_platform_lock(), the allocations can be split between N lists (shards), each with it's own lock:
+	#define HEAPS_SHARDS	<N>
+	and provide a lock for each shard, i is from 0 to N-1:
+		heaps_platform_shard_lock(i)
+		heaps_platform_shard_unlock(i)
+	The shard is chosen by a hash of the allocation's address, so a free finds it without reading memory, and takes only that shard's lock.
+	heaps_platform_lock() is not used, so heaps_platform_alloc() etc. must be thread safe themselves, as must heaps_platform_check().
+	Reports, heaps_get_allocation_list() and heaps_get_next_allocation() cover every shard.
+	The pre-operation walk is not done, heaps_check_step() walks one shard each call instead (taking turns), and calls heaps_platform_check().
+	This implies HEAPS_ATOMIC_STATS, and can only be used with a linked list (singly or HEAPS_DOUBLY_LINKED), without HEAPS_SITE_COUNTERS.
+
+On platforms with pthreads, each thread can instead keep it's own list of the allocations it makes, if you define the symbol:
+	#define HEAPS_PER_THREAD	<N>
+	N is the most threads which may have allocations at once (at least 2), a thread takes one of the N lists when it first allocates.
+	A thread which has run out of lists can't allocate, and a free from a thread which has never allocated is only accepted for another thread's allocation.
+	Allocating, and freeing an allocation made by the same thread, then only touch that thread's list.
+	An allocation made by another thread is checked by it's tag, and pushed to the owning thread's queue of remote frees (lock free),
+	the owner unlinks it and calls heaps_platform_free() the next time it allocates or frees. It is no longer counted as soon as it is queued.
+	When a thread exits, it's list is kept with any allocations left in it, and is taken over by the next thread to need one.
+	A report, or heaps_check_step(), empties each thread's queue before visiting that thread's list, so reports only show allocations which haven't been freed.
+	Each list has a flag which is held by it's owner while it's in use, so only a report or heaps_check_step() can make an allocating thread wait.
+	heaps_platform_lock() is not used, so heaps_platform_alloc() etc. must be thread safe themselves, as must heaps_platform_check().
+	This implies HEAPS_DOUBLY_LINKED and HEAPS_ATOMIC_STATS, and can't be used with HEAPS_SHARDS or anything which can't be used with HEAPS_SHARDS.
+
+To serve small allocations from size classes, instead of passing each one to the allocator, define the symbol:
+	#define HEAPS_SLAB
+	A block (the allocation plus it's heaps_t) of up to HEAPS_SLAB_MAX (default 1024) bytes is then rounded up to a size class, and taken
+	from that class's list of freed blocks, or carved from a chunk of HEAPS_SLAB_CHUNK (default 16384) bytes taken from the allocator.
+	There are two classes per power of 2, every one a multiple of the alignment of heaps_t, so at most a third of a block is wasted.
+	Freeing a block pushes it back onto it's class's list, so both take O(1) time. Larger allocations go to the allocator as usual.
+	The blocks are tracked just as before, so reports still give their file:line, but chunks are never given back to the allocator
+	(except by heaps_instance_destroy()) and are not tracked. heaps_get_headroom() doesn't count the free blocks kept in chunks.
+	HEAPS_SLAB_MAX must be a power of 2, and HEAPS_SLAB_CHUNK must be larger than HEAPS_SLAB_MAX.
+	The lists are protected by heaps_platform_lock(), so this can't be used with HEAPS_SHARDS, HEAPS_PER_THREAD or HEAPS_SIDE_TABLE.
+
+On platforms with pthreads, each thread can keep the blocks it frees for itself to reuse, by defining the symbol:
+	#define HEAPS_THREAD_CACHE	<N>
+	A freed block of up to HEAPS_SLAB_MAX bytes is then pushed onto the thread's list (magazine) for it's size class, unless that
+	already holds N blocks, and the next allocation of the same class by the thread pops it without calling the allocator.
+	The size classes are those of HEAPS_SLAB, so blocks of up to HEAPS_SLAB_MAX bytes are rounded up to their class even without HEAPS_SLAB.
+	With HEAPS_SHARDS or HEAPS_PER_THREAD a reused block takes no lock at all, otherwise heaps_platform_lock() is still taken to link it.
+	A thread's magazines are flushed back to the allocator (or to HEAPS_SLAB's lists) when it exits, or when it calls heaps_cache_flush().
+	heaps_get_cache_hit_count() and heaps_get_cache_miss_count() give the allocations which did and didn't find a block in a magazine.
+	Each thread adds it's counts to these every 64 allocations, and when it's magazines are flushed.
+	This can't be used with HEAPS_INSTANCES or HEAPS_SIDE_TABLE.
+
+To track only a statistical sample of the allocations, at a lower cost for the rest, define the symbol:
+	#define HEAPS_SAMPLING	<N>
+	Allocations are then picked by a byte based Poisson sampler, one per N bytes allocated on average (524288 is a good choice).
+	A picked allocation is tracked as usual. The rest are given a small header holding only their size and a tag derived from it's own address,
+	they skip the pre-operation checks, are not linked, and don't appear in reports, but are counted by heaps_get_allocation_count() etc.
+	A free or realloc reads that tag first, to tell the two apart, so (as with HEAPS_DOUBLY_LINKED) the memory before a pointer is read.
+	heaps_realloc() keeps an allocation sampled or not, as it was. heaps_set_sampling_interval(0) samples every allocation.
+	heaps_report() then gives estimates, each source location's count and size are scaled by 1/(1-exp(-s/N)), the inverse of the chance
+	of sampling an allocation of it's average size s. count_error and size_error give the range within which the true values are
+	expected to be, with about 95% confidence (two standard deviations).
+	This can't be used with HEAPS_SHARDS, HEAPS_PER_THREAD or HEAPS_SIDE_TABLE.
+
+By default all of the tracking state is for a single heap. To track several heaps seperately, each with it's own backend, lock and statistics, define the symbol:
+	#define HEAPS_INSTANCES
+	heaps_instance_create(&backend) then returns an instance, backend gives the functions to allocate from, check and lock it's heap.
+	heaps_instance_alloc(inst, size) etc. work as heaps_alloc(size) etc. but on inst, and inst's own statistics are read with heaps_instance_get_...(inst).
+	heaps_alloc() etc. use the default instance (heaps_default_instance()), whose backend calls the heaps_platform_ functions as usual.
+	An instance's backend must provide alloc() and realloc() if heaps_platform_alloc and heaps_platform_realloc are defined, the others may be NULL.
+	The instance a thread is working on is kept in thread local storage. HEAPS_CHECKER_THREAD only checks the default instance.
+	With HEAPS_SHARDS an instance's lock() and unlock() are not used, heaps_platform_shard_lock(i) locks shard i of every instance.
+	This can't be used with HEAPS_PER_THREAD, HEAPS_SIDE_TABLE or HEAPS_SITE_COUNTERS (or the modes which imply it), as their state is global.
+
+The statistics getters (heaps_get_allocation_count() etc.) never take the lock. To make them safe to poll from another thread, define the symbol:
+	#define HEAPS_ATOMIC_STATS
+	The allocation count, peak, headroom and largest allocation are then updated with atomic operations (compare and swap loops for
+	the peak, headroom and largest allocation), so the updates need no lock of their own, as are the members of heaps_stats_t.
+	heaps_get_allocation_count(), heaps_get_allocation_count_peak() and heaps_get_headroom() are single atomic loads (wait free).
+	heaps_get_largest_allocation() retries if it overlaps an update of the largest allocation, so it is lock free but not wait free.
+	heaps_get_stats() loads each member of heaps_stats_t atomically, but not all of them at once, so they may be from slightly different times.
+
+By default heaps_free() and heaps_realloc() find an allocation by walking the list from the head, which is O(n) in the number of allocations.
+To make this O(1), define the symbol:
+	#define HEAPS_DOUBLY_LINKED
+	Each heaps_t then also carries a back link (prev) and a validation tag derived from it's own address.
+	A pointer is validated by checking it's alignment, it's tag, and that it's neighbours link back to it.
+	Note that this reads the memory just before the pointer being freed, so a wild pointer may be dereferenced before it is rejected.
+
+As an alternative to linking the heaps_t structures together, heaps can index them in a hash table, by defining the symbol:
+	#define HEAPS_HASH_TABLE
+	The table is an open addressed (linear probing) array of content pointers, allocated from the platform allocator and not tracked.
+	heaps_t then has no next member, use heaps_get_next_allocation() to iterate. The order of iteration is not the order of allocation.
+	A pointer is validated by a table lookup, so no heaps_t is read until the pointer is known to be good.
+	The table doubles when it would become more than 1/2 full, and halves when less than 1/8 full, but never below HEAPS_HASH_TABLE_MIN (default 64).
+	HEAPS_HASH_TABLE can not be used with HEAPS_DOUBLY_LINKED.
+
+If the allocator hands out memory from a single region of known size, heaps can keep the heaps_t structures in a static side table,
+with one entry per HEAPS_SIDE_TABLE_GRANULE bytes of the region, instead of in front of each allocation. Define the symbols:
+	#define HEAPS_SIDE_TABLE
+	#define HEAPS_SIDE_TABLE_SPAN		<size of the region in bytes>
+	#define HEAPS_SIDE_TABLE_GRANULE	<alignment of every allocation, default __BIGGEST_ALIGNMENT__>
+	and provide a function or macro which gives the lowest address the allocator can return:
+		void* heaps_platform_base(void)
+	A pointer is validated by indexing the table with (ptr - base) / granule, so a free or realloc never reads the memory around ptr.
+	Allocations are not padded by a heaps_t, and stray writes to the heap can not reach the meta data.
+	The table takes (HEAPS_SIDE_TABLE_SPAN / HEAPS_SIDE_TABLE_GRANULE) * sizeof(heaps_t) bytes of static memory.
+	heaps_t then has no next member, use heaps_get_next_allocation() to iterate, and heaps_content_of() for the address of an allocation.
+	The pre-operation walk scans the whole table, so consider HEAPS_WALK_CHECK_BUDGET or HEAPS_NO_PRE_OPERATION_WALK_CHECK.
+	This implies HEAPS_SITE_COUNTERS, and can not be used with HEAPS_HASH_TABLE, HEAPS_DOUBLY_LINKED or HEAPS_COMPACT_HEADER.
+
+To detect corrupt meta data in constant time, instead of walking the list before each operation, define the symbol:
+	#define HEAPS_HEADER_CHECKSUM
+	Each heaps_t then carries a checksum of it's members, seeded with a magic number.
+	Each operation verifies only the heaps_t structures it touches (the allocation and it's neighbours), and re-seals any it modifies.
+	The pre-operation walk is not done (unless HEAPS_WALK_CHECK_BUDGET is defined), but heaps_platform_check() will still be called if it has been provided.
+
+By default a report is built by walking every allocation, and searching the source locations found so far for each one.
+To keep the count and size of each source location up to date as allocations are linked and unlinked, define the symbol:
+	#define HEAPS_SITE_COUNTERS
+	A report then only copies the source locations which have allocations, and takes O(source locations) time.
+	The source locations are kept in a static table of HEAPS_MAX_SITES (default 256) entries, which is never emptied.
+	If it becomes full, allocations from further source locations are counted together under a single heaps.h source location.
+
+To read the report while other threads carry on allocating, define the symbol:
+	#define HEAPS_LOCK_FREE_REPORT
+	Each site's count and size are then updated inside a sequence count (odd while they are being written), and the table's
+	entries are published with atomic operations, so heaps_report_snapshot() can copy them without taking the lock.
+	A site whose counts change while it is being copied is copied again, so each entry is consistent, and nothing waits for
+	the reader. The entries are taken at slightly different moments, so the snapshot as a whole is close to, but not exactly,
+	the state at any one time. The allocating threads pay two extra stores and two fences per allocation and free.
+	This implies HEAPS_SITE_COUNTERS.
+
+To keep the high water marks of each source location, define the symbol:
+	#define HEAPS_SITE_PEAKS
+	Each site then also keeps the highest count and size it has had, and the number of allocations it has ever made, updated as
+	allocations are linked, in the count_peak, size_peak and total members of heaps_report_t. heaps_report_peaks() also reports the source
+	locations which have no allocations now, so that those which only briefly used a lot of memory can be found.
+	With HEAPS_SAMPLING these are of the sampled allocations only, and are not scaled. This implies HEAPS_SITE_COUNTERS.
+
+To find the source locations which make short lived allocations (which might be better served by an arena or a slab), define the symbol:
+	#define HEAPS_LIFETIMES
+	Each heaps_t then holds the number of allocations made before it, and when it is freed the number made meanwhile is it's lifetime.
+	Each site counts it's freed allocations in a histogram of HEAPS_LIFETIME_BINS (default 16, at most 33) log2 lifetime bins, given as
+	the lifetimes member of heaps_report_t. lifetimes[0] is for those freed before another allocation was made, lifetimes[b] for lifetimes
+	of 2^(b-1) to 2^b-1, and the last bin also takes longer ones. A reallocation ends one lifetime and starts another.
+	With HEAPS_LOCK_FREE_REPORT the bins aren't covered by the sequence count, so they may be a few frees apart from count in a snapshot.
+	This adds 4 bytes to heaps_t (which then no longer fits in 16 with HEAPS_COMPACT_HEADER), and implies HEAPS_SITE_COUNTERS.
+
+To record every allocation and free, to be analysed or replayed offline, define the symbol:
+	#define HEAPS_TRACE
+	heaps_alloc(), heaps_free(), heaps_realloc() and heaps_calloc() then each write a 32 byte heaps_trace_event_t to a ring buffer
+	of the calling thread, without taking a lock. There are HEAPS_TRACE_THREADS (default 4) rings of HEAPS_TRACE_EVENTS (default 256,
+	a power of 2) events. A thread takes a free ring when it first traces, and gives it back when it exits (using pthreads).
+	An event is dropped (and counted by heaps_trace_dropped()) if the thread's ring is full, or there was no free ring for it.
+	heaps_trace_drain() copies events out of the rings, in order for each thread, and may only be called by one thread at a time.
+	The events are timed by heaps_platform_time() if it is provided (returning a uint64_t), otherwise by a count of the events
+	traced by every thread, so the threads' events can be merged. A free is timed before the memory is given back, and an
+	allocation after it is made, so an address is freed before it is allocated again (a realloc racing a free may still overlap).
+	The site of an event is heaps_trace_site(file, line), a 16bit hash of the source location.
+	Only the functions of the default instance are traced, batch allocations and frees are traced as one event per allocation,
+	and the allocations made for arenas and reports are not traced.
+
+To store a single pointer to a static descriptor of the source location in each heaps_t, instead of the file and line, define the symbol:
+	#define HEAPS_STATIC_SITES
+	heaps_alloc(), heaps_realloc() and heaps_calloc() then each create a function local static heaps_site_t (using a GNU statement expression).
+	The descriptor holds the count and size of the site, so they are updated without searching for it, and heaps_report() doesn't compare strings.
+	Use heaps_file_of() and heaps_line_of() to get the source location of a heaps_t, these work in every configuration.
+	Calling heaps_alloc_() etc. directly is still allowed, the source location is then found as for HEAPS_SITE_COUNTERS (which this implies).
+
+To make heaps_t as small as possible (16 bytes on 64bit platforms, where it is normally 32), define the symbol:
+	#define HEAPS_COMPACT_HEADER
+	heaps_t then holds a 32bit size, a 16bit index into the site table, and a 32bit offset to the next heaps_t instead of a pointer.
+	The offset is in units of the alignment of heaps_t, so every allocation must be within 2^30 of those units (16GiB with 16 byte alignment)
+	of the first one. This suits a heap in a single region, but not an allocator which maps memory anywhere (such as glibc's malloc for large sizes).
+	An allocation which is too large, or out of range, fails with "allocation tracking failed".
+	heaps_get_site() gives the site of a heaps_t. This implies HEAPS_SITE_COUNTERS, HEAPS_MAX_SITES may not be more than 65535,
+	and it can not be used with HEAPS_DOUBLY_LINKED.
+
 Then:
 	#include "heaps.h"
 
@@ -59,12 +252,15 @@ Then:
 
  Heaps will link together every allocation together with some meta data of the callers source location (file+line) and size.
  This linked list of heaps_t structures is available to the application by calling heaps_get_allocation_list().
+ It may be iterated with heaps_get_next_allocation(), which works in every configuration, or by following the next member (which is an offset with HEAPS_COMPACT_HEADER).
  
  Any call to heaps_free() will check the linked list of allocations to verify the address was previously returned by heaps_alloc().
  The error handler will be called if a heaps_free() or heaps_realloc() operation is attempted on an invalid address.  
 
  Various statistics are available, including the peak allocation count, headroom (if heaps_platform_largest_free is provided),
   details of the largest allocation made, and a report detailing the number of allocations and size used by each source location.
+ heaps_get_stats() gives the bytes in use and their peak, the allocations and frees ever made, and a histogram of the current allocations
+  by power of two size. These are kept up to date as allocations are linked and unlinked, so reading them doesn't walk anything.
 
 */
 
@@ -82,18 +278,130 @@ Then:
 		#define STATIC_IF_SANDBOXED
 	#endif
 
+#if (defined HEAPS_STATIC_SITES || defined HEAPS_COMPACT_HEADER || defined HEAPS_SIDE_TABLE || defined HEAPS_LOCK_FREE_REPORT || defined HEAPS_SITE_PEAKS || defined HEAPS_LIFETIMES)
+	#ifndef HEAPS_SITE_COUNTERS
+		#define HEAPS_SITE_COUNTERS
+	#endif
+#endif
+
+#if (defined HEAPS_LIFETIMES && !defined HEAPS_LIFETIME_BINS)
+	#define HEAPS_LIFETIME_BINS	16
+#endif
+
+#if (defined HEAPS_TRACE && !defined HEAPS_TRACE_THREADS)
+	#define HEAPS_TRACE_THREADS	4
+#endif
+#if (defined HEAPS_TRACE && !defined HEAPS_TRACE_EVENTS)
+	#define HEAPS_TRACE_EVENTS	256
+#endif
+
+#if ((defined HEAPS_SHARDS || defined HEAPS_PER_THREAD) && !defined HEAPS_ATOMIC_STATS)
+	#define HEAPS_ATOMIC_STATS
+#endif
+
+#if (defined HEAPS_PER_THREAD && !defined HEAPS_DOUBLY_LINKED)
+	#define HEAPS_DOUBLY_LINKED
+#endif
+
+#ifdef HEAPS_STATIC_SITES
+	#define HEAPS_SITE()			({static heaps_site_t heaps_site_ = {.file = __FILE__, .line = __LINE__}; &heaps_site_;})
+	#define heaps_alloc(size) 		heaps_alloc_site_(size, HEAPS_SITE())
+	#define heaps_free(ptr)			heaps_free_(ptr, __FILE__, __LINE__)
+	#define heaps_realloc(ptr,size)	heaps_realloc_site_(ptr, size, HEAPS_SITE())
+	#define heaps_calloc(qty,size)	heaps_calloc_site_(qty, size, HEAPS_SITE())
+	#define heaps_alloc_batch(sizes,n,ptrs)	heaps_alloc_batch_site_(sizes, n, ptrs, HEAPS_SITE())
+	#define heaps_file_of(meta)		((meta)->site->file)
+	#define heaps_line_of(meta)		((meta)->site->line)
+#else
 	#define heaps_alloc(size) 		heaps_alloc_(size, __FILE__, __LINE__)
 	#define heaps_free(ptr)			heaps_free_(ptr, __FILE__, __LINE__)
 	#define heaps_realloc(ptr,size)	heaps_realloc_(ptr, size, __FILE__, __LINE__)
 	#define heaps_calloc(qty,size)	heaps_calloc_(qty, size, __FILE__, __LINE__)
+	#define heaps_alloc_batch(sizes,n,ptrs)	heaps_alloc_batch_(sizes, n, ptrs, __FILE__, __LINE__)
+	#define heaps_file_of(meta)		((meta)->file)
+	#define heaps_line_of(meta)		((meta)->line)
+#endif
+	#define heaps_free_batch(ptrs,n)	heaps_free_batch_(ptrs, n, __FILE__, __LINE__)
+	#define heaps_arena_create(chunk_size)	heaps_arena_create_(chunk_size, __FILE__, __LINE__)
+
+#ifdef HEAPS_INSTANCES
+	#define heaps_instance_alloc(inst,size) 		heaps_instance_alloc_(inst, size, __FILE__, __LINE__)
+	#define heaps_instance_free(inst,ptr)			heaps_instance_free_(inst, ptr, __FILE__, __LINE__)
+	#define heaps_instance_realloc(inst,ptr,size)	heaps_instance_realloc_(inst, ptr, size, __FILE__, __LINE__)
+	#define heaps_instance_calloc(inst,qty,size)	heaps_instance_calloc_(inst, qty, size, __FILE__, __LINE__)
+	#define heaps_instance_alloc_batch(inst,sizes,n,ptrs)	heaps_instance_alloc_batch_(inst, sizes, n, ptrs, __FILE__, __LINE__)
+	#define heaps_instance_free_batch(inst,ptrs,n)			heaps_instance_free_batch_(inst, ptrs, n, __FILE__, __LINE__)
+#endif
+
+#ifdef HEAPS_COMPACT_HEADER
+	#undef heaps_file_of
+	#undef heaps_line_of
+	#define heaps_file_of(meta)		(heaps_get_site(meta)->file)
+	#define heaps_line_of(meta)		(heaps_get_site(meta)->line)
+#endif
+
+#ifdef HEAPS_SIDE_TABLE
+	#define heaps_content_of(meta)	heaps_get_content(meta)
+#else
+	#define heaps_content_of(meta)	((void*)(meta)->content)
+#endif
+
+	typedef struct heaps_site_t
+	{
+		const char* 	file;
+		int 			line;
+		int 			count;
+		size_t 			size;
+		int				index;			// index+1 of the site in the site table, 0 until it is added
+	#ifdef HEAPS_SITE_PEAKS
+		int				count_peak;
+		size_t			size_peak;
+		size_t			total;			// allocations ever made
+	#endif
+	#ifdef HEAPS_LIFETIMES
+		unsigned		lifetimes[HEAPS_LIFETIME_BINS];
+	#endif
+	#ifdef HEAPS_LOCK_FREE_REPORT
+		unsigned		seq;			// odd while count and size are being updated
+	#endif
+	} heaps_site_t;
 
 	typedef struct heaps_t
 	{
+	#if (defined HEAPS_COMPACT_HEADER)
+		uint32_t		size;
+		uint16_t		site;		// index of the site in the site table
+	#elif (defined HEAPS_STATIC_SITES)
+		size_t			size;
+		heaps_site_t*	site;
+	#else
 		size_t			size;
 		const char* 	file;
 		int 			line;
+	#endif
+	#ifdef HEAPS_HEADER_CHECKSUM
+		uint32_t		check;		// fits in the padding after line on 64bit platforms (or before next, with HEAPS_STATIC_SITES)
+	#endif
+	#ifdef HEAPS_LIFETIMES
+		uint32_t		born;		// the number of allocations made before this one (modulo 2^32)
+	#endif
+	#if (defined HEAPS_HASH_TABLE || defined HEAPS_SIDE_TABLE)
+	#elif (defined HEAPS_COMPACT_HEADER)
+		int32_t			next;		// offset to the next heaps_t in units of it's alignment, 0 if there is none
+	#else
 		struct heaps_t* next;
+	#endif
+	#ifdef HEAPS_DOUBLY_LINKED
+		struct heaps_t* prev;
+		uintptr_t		tag;
+	#endif
+	#ifdef HEAPS_PER_THREAD
+		void*			owner;			// the list of the thread which made the allocation
+		struct heaps_t*	remote_next;	// NULL unless queued to be freed by the owner
+	#endif
+	#ifndef HEAPS_SIDE_TABLE
 		uint8_t		content[0] __attribute__((aligned));
+	#endif
 	} heaps_t;
 
 	typedef struct heaps_report_t
@@ -102,8 +410,71 @@ Then:
 		int 			line;
 		int 			count;
 		size_t 			size;
+		int				arena_count;	// allocations made from the live arenas created here, their chunks are in count and size
+		size_t			arena_size;
+	#ifdef HEAPS_SAMPLING
+		int				count_error;	// in reports, the estimated count and size are within these of the true values (95% confidence)
+		size_t			size_error;
+	#endif
+	#ifdef HEAPS_SITE_PEAKS
+		int				count_peak;		// the highest count and size the source location has had
+		size_t			size_peak;
+		size_t			total;			// the allocations it has ever made
+	#endif
+	#ifdef HEAPS_LIFETIMES
+		unsigned		lifetimes[HEAPS_LIFETIME_BINS];	// freed allocations by log2 of the number of allocations made meanwhile
+	#endif
 	} heaps_report_t;
 
+//	Bytes in use and a size histogram, from heaps_get_stats(). A reallocation counts as a free and an allocation.
+	#define HEAPS_STATS_BINS	(sizeof(size_t)*8+1)
+
+	typedef struct heaps_stats_t
+	{
+		size_t			bytes;						// the total size of the current allocations
+		size_t			bytes_peak;					// the highest that bytes has been
+		size_t			alloc_total;				// allocations ever linked
+		size_t			free_total;					// allocations ever unlinked
+		size_t			histogram[HEAPS_STATS_BINS];// current allocations by size, [0] for size 0, [b] for sizes 2^(b-1) to 2^b-1
+	} heaps_stats_t;
+
+#ifdef HEAPS_TRACE
+	typedef enum {HEAPS_TRACE_ALLOC = 1, HEAPS_TRACE_FREE, HEAPS_TRACE_REALLOC, HEAPS_TRACE_CALLOC} heaps_trace_op_t;
+
+	typedef struct heaps_trace_event_t
+	{
+		uint64_t		time;
+		uint64_t		ptr;		// the allocation made or freed, for realloc the new allocation (0 if one wasn't made)
+		uint64_t		old;		// for realloc, the allocation it was given
+		uint32_t		size;		// the size requested (qty*size for calloc, UINT32_MAX if larger), 0 for free
+		uint16_t		site;		// heaps_trace_site() of the source location
+		uint8_t			op;			// a heaps_trace_op_t
+		uint8_t			thread;		// the ring it was traced to
+	} heaps_trace_event_t;
+#endif
+
+//	Called by heaps_report_foreach() for each source location, with the context it was given
+	typedef void (*heaps_report_callback_t)(const heaps_report_t* entry, void* context);
+
+#ifdef HEAPS_INSTANCES
+//	The functions an instance uses for it's heap, each is passed context.
+	typedef struct heaps_backend_t
+	{
+		void*	context;
+		void*	(*alloc)(void* context, size_t size);
+		void*	(*realloc)(void* context, void* ptr, size_t size);
+		void	(*free)(void* context, void* ptr);
+		bool	(*check)(void* context);			// may be NULL, as may the below
+		size_t	(*largest_free)(void* context);
+		void	(*lock)(void* context);
+		void	(*unlock)(void* context);
+	} heaps_backend_t;
+
+	typedef struct heaps_instance_t heaps_instance_t;
+#endif
+
+	typedef struct heaps_arena_t heaps_arena_t;
+
 //********************************************************************************************************
 // Public variables
 //********************************************************************************************************
@@ -116,21 +487,152 @@ Then:
 	STATIC_IF_SANDBOXED void* heaps_free_(void* ptr, const char* file, int line);
 	STATIC_IF_SANDBOXED void* heaps_realloc_(void* ptr, size_t size, const char* file, int line);
 	STATIC_IF_SANDBOXED void* heaps_calloc_(size_t qty, size_t size, const char* file, int line);
+#ifdef HEAPS_STATIC_SITES
+	STATIC_IF_SANDBOXED void* heaps_alloc_site_(size_t size, heaps_site_t* site);
+	STATIC_IF_SANDBOXED void* heaps_realloc_site_(void* ptr, size_t size, heaps_site_t* site);
+	STATIC_IF_SANDBOXED void* heaps_calloc_site_(size_t qty, size_t size, heaps_site_t* site);
+	STATIC_IF_SANDBOXED size_t heaps_alloc_batch_site_(const size_t* sizes, size_t n, void** ptrs, heaps_site_t* site);
+#endif
+
+//	Allocate n blocks of sizes[0..n-1] into ptrs[0..n-1], or free n allocations (NULLs are skipped), as one operation.
+//	The lock is taken, and the heap checked, once for the whole batch, and the statistics are updated once after allocating.
+//	heaps_alloc_batch() returns the number allocated. If one fails it stops there (after calling the error handler),
+//	setting the rest of ptrs to NULL, the ones already made are kept and can be given back with heaps_free_batch().
+	STATIC_IF_SANDBOXED size_t heaps_alloc_batch_(const size_t* sizes, size_t n, void** ptrs, const char* file, int line);
+	STATIC_IF_SANDBOXED void heaps_free_batch_(void** ptrs, size_t n, const char* file, int line);
+
+//	Create an arena, which hands out memory from chunks of chunk_size bytes (or larger, for an allocation which doesn't fit in one).
+//	The arena and it's chunks are allocations of the default instance, made by the caller of heaps_arena_create(), so they appear in reports.
+//	heaps_arena_alloc() bumps a pointer through the newest chunk, so it doesn't take the lock unless it needs a new chunk.
+//	There is no free, everything allocated from an arena is freed by heaps_arena_destroy(). An arena must only be used by one thread at a time.
+//	heaps_arena_report() gives the arena's source location, and the number and total size of the allocations made from it.
+//	Reports (except heaps_report_snapshot()) add these to the arena_count and arena_size of the entry for it's source location.
+//	heaps_arena_create() and heaps_arena_alloc() return NULL (after calling the error handler) if a chunk can't be allocated, or the size is too large to round up.
+//	An allocation of 0 bytes is given it's own pointer (as if 1 byte was asked for), whether or not the arena has a chunk yet.
+	STATIC_IF_SANDBOXED heaps_arena_t* heaps_arena_create_(size_t chunk_size, const char* file, int line);
+	STATIC_IF_SANDBOXED void* heaps_arena_alloc(heaps_arena_t* arena, size_t size);
+	STATIC_IF_SANDBOXED void heaps_arena_destroy(heaps_arena_t* arena);
+	STATIC_IF_SANDBOXED heaps_report_t heaps_arena_report(heaps_arena_t* arena);
 
 	STATIC_IF_SANDBOXED int heaps_get_allocation_count(void);					// The current number of allocations
 	STATIC_IF_SANDBOXED int heaps_get_allocation_count_peak(void);				// The highest number of allocations that has ever occurred.
 	STATIC_IF_SANDBOXED size_t heaps_get_headroom(void);						// The minimum free space that has occurred since reset.
 	STATIC_IF_SANDBOXED heaps_report_t heaps_get_largest_allocation(void);		// Return details (file/line/size) of the largest allocation ever made.
+	STATIC_IF_SANDBOXED size_t heaps_get_walk_pass_count(void);					// The number of complete passes made by the pre-operation walk.
+	STATIC_IF_SANDBOXED heaps_stats_t heaps_get_stats(void);					// Bytes in use, their peak, alloc/free totals and the size histogram.
+
+//	Continue the walk by one step, and call heaps_platform_check(). Returns false (after calling the error handler) if a problem was found.
+	STATIC_IF_SANDBOXED bool heaps_check_step(void);
+
+#ifdef HEAPS_CHECKER_THREAD
+//	Start or stop a thread which calls heaps_check_step() every interval_us microseconds.
+//	heaps_checker_start() returns false if the thread could not be started, or is already running.
+	STATIC_IF_SANDBOXED bool heaps_checker_start(unsigned long interval_us);
+	STATIC_IF_SANDBOXED void heaps_checker_stop(void);
+#endif
+
+#ifdef HEAPS_THREAD_CACHE
+//	The allocations which have, and haven't, reused a block from the allocating thread's magazines.
+	STATIC_IF_SANDBOXED size_t heaps_get_cache_hit_count(void);
+	STATIC_IF_SANDBOXED size_t heaps_get_cache_miss_count(void);
+
+//	Give the blocks in the calling thread's magazines back to the allocator.
+	STATIC_IF_SANDBOXED void heaps_cache_flush(void);
+#endif
+
+#ifdef HEAPS_TRACE
+//	Move up to capacity events from the rings to buf, returns the number moved. Only one thread may drain at a time.
+	STATIC_IF_SANDBOXED size_t heaps_trace_drain(heaps_trace_event_t* buf, size_t capacity);
+
+//	The number of events which have been dropped, because a thread's ring was full or it couldn't get one.
+	STATIC_IF_SANDBOXED size_t heaps_trace_dropped(void);
+
+//	The site which a source location is traced as.
+	STATIC_IF_SANDBOXED uint16_t heaps_trace_site(const char* file, int line);
+#endif
+
+#ifdef HEAPS_SAMPLING
+//	Set or get the mean number of bytes allocated between sampled allocations, 0 samples every allocation.
+//	This is shared by every instance, and should only be changed while no other thread is allocating.
+//	The default instance's next allocation is sampled, and the gap after it drawn with the new interval, other instances change after their next sample.
+	STATIC_IF_SANDBOXED void heaps_set_sampling_interval(size_t bytes);
+	STATIC_IF_SANDBOXED size_t heaps_get_sampling_interval(void);
+#endif
 
 //	Get the head of a linked list of allocations
 	STATIC_IF_SANDBOXED heaps_t* heaps_get_allocation_list(void);
 
-//	This feature is used for finding leaks, it is only provided if heaps_platform_realloc is available.
+//	Get the allocation after link, or NULL if link is the last one.
+	STATIC_IF_SANDBOXED heaps_t* heaps_get_next_allocation(heaps_t* link);
+
+#ifdef HEAPS_SIDE_TABLE
+//	Get the address of an allocation (what was returned by heaps_alloc()), heaps_content_of() uses this in every configuration.
+	STATIC_IF_SANDBOXED void* heaps_get_content(heaps_t* link);
+#endif
+
+#ifdef HEAPS_COMPACT_HEADER
+//	Get the site which made an allocation. Sites are never removed from the table, so this does not need the lock.
+	STATIC_IF_SANDBOXED heaps_site_t* heaps_get_site(heaps_t* link);
+#endif
+
+//	This feature is used for finding leaks, it is only provided if heaps_platform_alloc or heaps_platform_realloc is available.
 //	Returns an array that for each source location, shows the number of current allocations, and total size used.
 //	One of these allocations will be the array itself, and it must be passed to heaps_free() when no longer needed.
+//	The array is allocated before it is filled in, if there are more source locations than it has room for it is allocated again with twice the room.
 //	The number of elements in the array is written to *arr_size. If this is 0, then the return value will be NULL and does not need to be freed.
 	STATIC_IF_SANDBOXED heaps_report_t* heaps_report(int* arr_size);
 
+//	As heaps_report(), but written to buf, which has room for capacity elements, so nothing is allocated.
+//	Returns false if there were more source locations than would fit, the elements written are still complete.
+	STATIC_IF_SANDBOXED bool heaps_report_into(heaps_report_t* buf, int capacity, int* arr_size);
+
+//	Call callback for each source location with allocations, in order of file name then line, without allocating.
+//	The source locations are gathered HEAPS_REPORT_PASS (default 16) at a time, each pass walking every allocation (unless HEAPS_SITE_COUNTERS)
+//	with the lock held. The callbacks for a pass are made after the lock is released, so they may use heaps (allocations made or freed
+//	meanwhile may or may not be counted by later passes).
+	STATIC_IF_SANDBOXED void heaps_report_foreach(heaps_report_callback_t callback, void* context);
+
+#ifdef HEAPS_LOCK_FREE_REPORT
+//	As heaps_report_into(), but without taking the lock, so allocating threads are never held up by it.
+//	Each entry is consistent, but they are copied one at a time while the allocations go on changing.
+	STATIC_IF_SANDBOXED bool heaps_report_snapshot(heaps_report_t* buf, int capacity, int* arr_size);
+#endif
+
+#ifdef HEAPS_SITE_PEAKS
+//	As heaps_report_into(), but also with the source locations which have made allocations and have none now.
+	STATIC_IF_SANDBOXED bool heaps_report_peaks(heaps_report_t* buf, int capacity, int* arr_size);
+#endif
+
+#ifdef HEAPS_INSTANCES
+//	Create an instance, which is allocated from the backend (with alloc, or realloc if alloc is NULL). Returns NULL if that fails.
+	STATIC_IF_SANDBOXED heaps_instance_t* heaps_instance_create(const heaps_backend_t* backend);
+
+//	Free an instance. Returns false, leaving the instance as it was, if it still has allocations.
+	STATIC_IF_SANDBOXED bool heaps_instance_destroy(heaps_instance_t* inst);
+
+//	The instance used by heaps_alloc() etc.
+	STATIC_IF_SANDBOXED heaps_instance_t* heaps_default_instance(void);
+
+//	As the functions above, but for the given instance
+	STATIC_IF_SANDBOXED void* heaps_instance_alloc_(heaps_instance_t* inst, size_t size, const char* file, int line);
+	STATIC_IF_SANDBOXED void* heaps_instance_free_(heaps_instance_t* inst, void* ptr, const char* file, int line);
+	STATIC_IF_SANDBOXED void* heaps_instance_realloc_(heaps_instance_t* inst, void* ptr, size_t size, const char* file, int line);
+	STATIC_IF_SANDBOXED void* heaps_instance_calloc_(heaps_instance_t* inst, size_t qty, size_t size, const char* file, int line);
+	STATIC_IF_SANDBOXED size_t heaps_instance_alloc_batch_(heaps_instance_t* inst, const size_t* sizes, size_t n, void** ptrs, const char* file, int line);
+	STATIC_IF_SANDBOXED void heaps_instance_free_batch_(heaps_instance_t* inst, void** ptrs, size_t n, const char* file, int line);
+	STATIC_IF_SANDBOXED int heaps_instance_get_allocation_count(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED int heaps_instance_get_allocation_count_peak(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED size_t heaps_instance_get_headroom(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED heaps_report_t heaps_instance_get_largest_allocation(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED heaps_stats_t heaps_instance_get_stats(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED bool heaps_instance_check_step(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED heaps_t* heaps_instance_get_allocation_list(heaps_instance_t* inst);
+	STATIC_IF_SANDBOXED heaps_t* heaps_instance_get_next_allocation(heaps_instance_t* inst, heaps_t* link);
+	STATIC_IF_SANDBOXED heaps_report_t* heaps_instance_report(heaps_instance_t* inst, int* arr_size);
+	STATIC_IF_SANDBOXED bool heaps_instance_report_into(heaps_instance_t* inst, heaps_report_t* buf, int capacity, int* arr_size);
+	STATIC_IF_SANDBOXED void heaps_instance_report_foreach(heaps_instance_t* inst, heaps_report_callback_t callback, void* context);
+#endif
+
 // 	The report may be sorted using qsort, and the comparator functions are provided
 //	Example:	qsort(arr, arr_size, sizeof(heaps_report_t), heaps_report_sorter_descending_count);
 	STATIC_IF_SANDBOXED int heaps_report_sorter_descending_size(const void* a, const void* b);
@@ -142,6 +644,13 @@ Then:
 #ifdef HEAPS_IMPLEMENTATION
 	#include <stdlib.h>
 	#include <string.h>
+#ifdef HEAPS_CHECKER_THREAD
+	#include <pthread.h>
+	#include <time.h>
+#endif
+#if (defined HEAPS_PER_THREAD || defined HEAPS_THREAD_CACHE || defined HEAPS_TRACE)
+	#include <pthread.h>
+#endif
 
 //********************************************************************************************************
 //********************************************************************************************************
@@ -169,386 +678,3735 @@ Then:
 		#define heaps_platform_unlock() ((void)0)
 	#endif
 
-//********************************************************************************************************
-// Private variables
-//********************************************************************************************************
-
-	static heaps_t* head = NULL;
-	static int allocation_count = 0;
-	static int allocation_count_peak = 0;
-	static size_t headroom = (size_t)-1;
-	static heaps_report_t largest_allocation = {0};
+	#if (defined HEAPS_HASH_TABLE && defined HEAPS_DOUBLY_LINKED)
+		#error "HEAPS_HASH_TABLE and HEAPS_DOUBLY_LINKED can not be used together"
+	#endif
+	#if (defined HEAPS_COMPACT_HEADER && defined HEAPS_DOUBLY_LINKED)
+		#error "HEAPS_COMPACT_HEADER and HEAPS_DOUBLY_LINKED can not be used together"
+	#endif
+	#if (defined HEAPS_SIDE_TABLE && (defined HEAPS_HASH_TABLE || defined HEAPS_DOUBLY_LINKED || defined HEAPS_COMPACT_HEADER))
+		#error "HEAPS_SIDE_TABLE can not be used with HEAPS_HASH_TABLE, HEAPS_DOUBLY_LINKED or HEAPS_COMPACT_HEADER"
+	#endif
+	#if (defined HEAPS_LIFETIMES && (HEAPS_LIFETIME_BINS < 1 || HEAPS_LIFETIME_BINS > 33))
+		#error "HEAPS_LIFETIME_BINS must be from 1 to 33"
+	#endif
+	#if (defined HEAPS_PER_THREAD && HEAPS_PER_THREAD < 2)
+		#error "HEAPS_PER_THREAD must be defined as the most threads which may have allocations at once, and at least 2"
+	#endif
 
-//********************************************************************************************************
-// Private prototypes
-//********************************************************************************************************
+	#if (defined HEAPS_SHARDS && (defined HEAPS_HASH_TABLE || defined HEAPS_SIDE_TABLE || defined HEAPS_SITE_COUNTERS))
+		#error "HEAPS_SHARDS can not be used with HEAPS_HASH_TABLE, HEAPS_SIDE_TABLE or HEAPS_SITE_COUNTERS (or the modes which imply it)"
+	#endif
 
-	static void* alloc_(size_t size, const char* file, int line);
-	static void* realloc_(void* ptr, size_t size, const char* file, int line);
-	static void* free_(void* ptr, const char* file, int line);
-	static void* calloc_(size_t qty, size_t size, const char* file, int line);
+	#if (defined HEAPS_PER_THREAD && (defined HEAPS_SHARDS || defined HEAPS_HASH_TABLE || defined HEAPS_SIDE_TABLE || defined HEAPS_SITE_COUNTERS))
+		#error "HEAPS_PER_THREAD can not be used with HEAPS_SHARDS, HEAPS_HASH_TABLE, HEAPS_SIDE_TABLE or HEAPS_SITE_COUNTERS (or the modes which imply it)"
+	#endif
 
+	#if (defined HEAPS_INSTANCES && (defined HEAPS_PER_THREAD || defined HEAPS_SIDE_TABLE || defined HEAPS_SITE_COUNTERS))
+		#error "HEAPS_INSTANCES can not be used with HEAPS_PER_THREAD, HEAPS_SIDE_TABLE or HEAPS_SITE_COUNTERS (or the modes which imply it)"
+	#endif
 
-	static void check_heap(const char* file, int line);
+	#if (defined HEAPS_SLAB && (defined HEAPS_SHARDS || defined HEAPS_PER_THREAD || defined HEAPS_SIDE_TABLE))
+		#error "HEAPS_SLAB can not be used with HEAPS_SHARDS, HEAPS_PER_THREAD or HEAPS_SIDE_TABLE"
+	#endif
 
-//	Given a pointer to a heaps_t, fill out the heaps_t members, link it, and return it's content
-	static void* link_allocation(heaps_t* meta, size_t size, const char* file, int line);
+	#if (defined HEAPS_THREAD_CACHE && (defined HEAPS_INSTANCES || defined HEAPS_SIDE_TABLE))
+		#error "HEAPS_THREAD_CACHE can not be used with HEAPS_INSTANCES or HEAPS_SIDE_TABLE"
+	#endif
 
-//	Given a void* to be freed, find it's containing heaps_t, unlink it, and return the address to free.
-//	Returns NULL if the given ptr is not a value previously returned by heaps_alloc().
-	static void* unlink_allocation(void* ptr);
+	#if (defined HEAPS_SAMPLING && (defined HEAPS_SHARDS || defined HEAPS_PER_THREAD || defined HEAPS_SIDE_TABLE))
+		#error "HEAPS_SAMPLING can not be used with HEAPS_SHARDS, HEAPS_PER_THREAD or HEAPS_SIDE_TABLE"
+	#endif
 
-	static void track_headroom(void);
+//	the allocations are split between several lists, each with it's own lock
+	#if (defined HEAPS_SHARDS || defined HEAPS_PER_THREAD)
+		#define SHARDED
+	#endif
 
-	static heaps_report_t* report(int* arr_size);
-	static bool add_to_report(heaps_report_t** dst, int* dst_size, heaps_t* src);
+#ifdef HEAPS_SHARDS
+	#define SHARD_COUNT		(HEAPS_SHARDS)
+	#ifndef heaps_platform_shard_lock
+		#define heaps_platform_shard_lock(i)	((void)0)
+	#endif
+	#ifndef heaps_platform_shard_unlock
+		#define heaps_platform_shard_unlock(i)	((void)0)
+	#endif
+	#define SHARD_LOCK(i)			heaps_platform_shard_lock(i)
+	#define SHARD_UNLOCK(i)			heaps_platform_shard_unlock(i)
+	#define SHARD_ENTER(block)		shard_enter(shard_index(block))
+	#define SHARD_LEAVE()			shard_leave()
+	#define SHARD_OF(link)			shard_index(link)
+#elif (defined HEAPS_PER_THREAD)
+	#define SHARD_COUNT		(HEAPS_PER_THREAD)
+//	a thread only waits for it's own list's flag while a report or heaps_check_step() holds it, so it spins
+	#define SHARD_LOCK(i)			while(__atomic_test_and_set(&instance->shards[i].busy, __ATOMIC_ACQUIRE))
+	#define SHARD_UNLOCK(i)			__atomic_clear(&instance->shards[i].busy, __ATOMIC_RELEASE)
+	#define SHARD_ENTER(block)		shard_enter((unsigned)(own_shard - instance->shards))
+	#define SHARD_LEAVE()			shard_leave()
+	#define SHARD_OF(link)			(unsigned)((shard_t*)(link)->owner - instance->shards)
+#else
+	#define SHARD_COUNT		1
+	#define SHARD_ENTER(block)		((void)0)
+	#define SHARD_LEAVE()			((void)0)
+#endif
 
-//********************************************************************************************************
-// Public functions
-//********************************************************************************************************
+#ifdef HEAPS_INSTANCES
+//	an instance's operations go to it's own backend, the default instance's backend calls the heaps_platform_ functions
+	#define PLATFORM_ALLOC(size)		instance->backend.alloc(instance->backend.context, size)
+	#define PLATFORM_REALLOC(ptr,size)	instance->backend.realloc(instance->backend.context, ptr, size)
+	#define PLATFORM_FREE(ptr)			instance->backend.free(instance->backend.context, ptr)
+	#define PLATFORM_CHECK()			(instance->backend.check ? instance->backend.check(instance->backend.context) : true)
+	#define PLATFORM_LARGEST_FREE()		(instance->backend.largest_free ? instance->backend.largest_free(instance->backend.context) : 0)
+	#define PLATFORM_LOCK()				do{if(instance->backend.lock) instance->backend.lock(instance->backend.context);}while(0)
+	#define PLATFORM_UNLOCK()			do{if(instance->backend.unlock) instance->backend.unlock(instance->backend.context);}while(0)
+	#ifdef SHARDED
+		#define INSTANCE_SELECT(inst)	(instance = (inst))
+	#else
+		#define INSTANCE_SELECT(inst)	(instance = (inst), shard = instance->shards)
+	#endif
+#else
+	#define PLATFORM_ALLOC(size)		heaps_platform_alloc(size)
+	#define PLATFORM_REALLOC(ptr,size)	heaps_platform_realloc(ptr, size)
+	#define PLATFORM_FREE(ptr)			heaps_platform_free(ptr)
+	#define PLATFORM_CHECK()			heaps_platform_check()
+	#define PLATFORM_LARGEST_FREE()		heaps_platform_largest_free()
+	#define PLATFORM_LOCK()				heaps_platform_lock()
+	#define PLATFORM_UNLOCK()			heaps_platform_unlock()
+	#define INSTANCE_SELECT(inst)		((void)0)
+#endif
 
-#ifdef heaps_platform_alloc
-STATIC_IF_SANDBOXED void* heaps_alloc_(size_t size, const char* file, int line)
-{
-	void* retval;
-	heaps_platform_lock();
-	retval = alloc_(size, file, line);
-	heaps_platform_unlock();
-	return retval;
-}
+#ifdef SHARDED
+//	each operation locks only the shard it works on
+	#undef PLATFORM_LOCK
+	#undef PLATFORM_UNLOCK
+	#define PLATFORM_LOCK()				((void)0)
+	#define PLATFORM_UNLOCK()			((void)0)
 #endif
 
-#ifdef heaps_platform_realloc
-STATIC_IF_SANDBOXED void* heaps_realloc_(void* ptr, size_t size, const char* file, int line)
-{
-	void* retval;
-	heaps_platform_lock();
-	retval = realloc_(ptr, size, file, line);
-	heaps_platform_unlock();
-	return retval;
-}
+//	blocks of up to HEAPS_SLAB_MAX bytes are rounded up to a size class
+#if (defined HEAPS_SLAB || defined HEAPS_THREAD_CACHE)
+	#define CLASSED
 #endif
 
-#ifdef heaps_platform_free
-STATIC_IF_SANDBOXED void* heaps_free_(void* ptr, const char* file, int line)
-{
-	void* retval;
-	heaps_platform_lock();
-	retval = free_(ptr, file, line);
-	heaps_platform_unlock();
-	return retval;
-}
+#ifdef HEAPS_SLAB
+	#ifndef HEAPS_SLAB_CHUNK
+		#define HEAPS_SLAB_CHUNK	16384
+	#endif
 #endif
 
-#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
-STATIC_IF_SANDBOXED void* heaps_calloc_(size_t qty, size_t size, const char* file, int line)
-{
-	void* retval;
-	heaps_platform_lock();
-	retval = calloc_(qty, size, file, line);
-	heaps_platform_unlock();
-	return retval;
-}
+#ifdef HEAPS_THREAD_CACHE
+	#define CACHE_PUBLISH_INTERVAL	64		// allocations counted by a thread before it adds them to the totals
+	#define CACHE_POP(class)		cache_pop(class)
+	#define CACHE_PUSH(block,class)	cache_push(block, class)
+#else
+	#define CACHE_POP(class)		NULL
+	#define CACHE_PUSH(block,class)	false
 #endif
 
-#ifdef heaps_platform_realloc
-STATIC_IF_SANDBOXED heaps_report_t* heaps_report(int* arr_size)
-{
-	heaps_report_t* retval;
-	heaps_platform_lock();
-	retval = report(arr_size);
-	heaps_platform_unlock();
-	return retval;
-}
+#ifdef CLASSED
+	#ifndef HEAPS_SLAB_MAX
+		#define HEAPS_SLAB_MAX		1024
+	#endif
+	#define SLAB_GRANULE		__alignof__(heaps_t)
+	#define SLAB_CLASSES		(2*__builtin_ctz(HEAPS_SLAB_MAX/SLAB_GRANULE))	// classes of 1,2,3,4,6,8,12,16.. granules
+//	blocks for the tracked allocations come from the size classes, or from the platform if they are too large
+	#define BLOCK_ALLOC(size)					slab_alloc(size)
+	#define BLOCK_REALLOC(block,old_size,size)	slab_realloc(block, old_size, size)
+	#define BLOCK_FREE(block,size)				slab_free(block, size)
+	#ifdef heaps_platform_alloc
+		#define PLATFORM_ALLOC_ANY(size)		PLATFORM_ALLOC(size)
+	#else
+		#define PLATFORM_ALLOC_ANY(size)		PLATFORM_REALLOC(NULL, size)
+	#endif
+#else
+	#define BLOCK_ALLOC(size)					PLATFORM_ALLOC(size)
+	#define BLOCK_REALLOC(block,old_size,size)	PLATFORM_REALLOC(block, size)
+	#define BLOCK_FREE(block,size)				PLATFORM_FREE(block)
+#endif
+#ifndef HEAPS_REPORT_PASS
+	#define HEAPS_REPORT_PASS	16
+#endif
 
-STATIC_IF_SANDBOXED int heaps_report_sorter_descending_count(const void* a, const void* b)
-{
-	return ((heaps_report_t*)b)->count - ((heaps_report_t*)a)->count;
-}
+#ifdef HEAPS_TRACE
+	#if (HEAPS_TRACE_EVENTS & (HEAPS_TRACE_EVENTS-1)) || HEAPS_TRACE_THREADS > 256
+		#error "HEAPS_TRACE_EVENTS must be a power of 2, and HEAPS_TRACE_THREADS may not be more than 256"
+	#endif
+	#define TRACE(op,ptr,old,size,file,line)	trace(op, ptr, old, size, file, line)
+#else
+	#define TRACE(op,ptr,old,size,file,line)	((void)0)
+#endif
 
-STATIC_IF_SANDBOXED int heaps_report_sorter_descending_size(const void* a, const void* b)
-{
-	return ((heaps_report_t*)b)->size - ((heaps_report_t*)a)->size;
-}
+//	the allocations visited by a report, and where the report allocated by heaps_report() comes from
+#ifdef SHARDED
+	#define REPORT_LINKED		__atomic_load_n(&instance->allocation_count, __ATOMIC_RELAXED)
+#else
+	#define REPORT_LINKED		shard->count
+#endif
+#ifdef heaps_platform_alloc
+	#define REPORT_ALLOC(size)	alloc_(size, NULL, __FILE__, __LINE__)
+#else
+	#define REPORT_ALLOC(size)	realloc_(NULL, size, NULL, __FILE__, __LINE__)
+#endif
+#ifdef heaps_platform_free
+	#define REPORT_FREE(arr)	free_(arr, __FILE__, __LINE__)
+#else
+	#define REPORT_FREE(arr)	realloc_(arr, 0, NULL, __FILE__, __LINE__)
 #endif
 
-STATIC_IF_SANDBOXED int heaps_get_allocation_count(void)
-{
-	return allocation_count;
-}
+//	arena allocations are aligned as heap allocations are
+	#define ARENA_ALIGN		__alignof__(heaps_t)
+	#define ARENA_ROUND(size)	(((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+	#define ARENA_LARGEST		(SIZE_MAX - (ARENA_ALIGN - 1) - ARENA_ALIGN)	// rounding this and adding a chunk's link doesn't wrap
 
-STATIC_IF_SANDBOXED int heaps_get_allocation_count_peak(void)
-{
-	return allocation_count_peak;
-}
+//	the list of live arenas is protected by the instance's lock, or with shards (which don't take it) by a flag of it's own
+#ifdef SHARDED
+	#define ARENAS_LOCK()		while(__atomic_test_and_set(&instance->arenas_busy, __ATOMIC_ACQUIRE))
+	#define ARENAS_UNLOCK()		__atomic_clear(&instance->arenas_busy, __ATOMIC_RELEASE)
+#else
+	#define ARENAS_LOCK()		((void)0)
+	#define ARENAS_UNLOCK()		((void)0)
+#endif
 
-STATIC_IF_SANDBOXED size_t heaps_get_headroom(void)
-{
-	return headroom;
-}
+//	the size of a block which has been unlinked, but not yet freed
+	#define BLOCK_SIZE(block)	WITH_HEADER(META_OF_BLOCK(block)->size)
 
-STATIC_IF_SANDBOXED heaps_report_t heaps_get_largest_allocation(void)
-{
-	return largest_allocation;
-}
+//	make an instance the one this thread works on, and take it's lock, or release it
+	#define INSTANCE_ENTER(inst)		do{INSTANCE_SELECT(inst); PLATFORM_LOCK();}while(0)
+	#define INSTANCE_LEAVE()			PLATFORM_UNLOCK()
 
-STATIC_IF_SANDBOXED heaps_t* heaps_get_allocation_list(void)
-{
-	return head;
-}
+//	the allocations are linked together through their heaps_t, unless they are indexed by a table
+	#if (!defined HEAPS_HASH_TABLE && !defined HEAPS_SIDE_TABLE)
+		#define LINKED_LIST
+	#endif
 
-//********************************************************************************************************
-// Private functions
-//********************************************************************************************************
+#ifdef HEAPS_SITE_COUNTERS
+	#ifndef HEAPS_MAX_SITES
+		#define HEAPS_MAX_SITES	256
+	#endif
+	#define SITE_SLOTS	(HEAPS_MAX_SITES*2)		// size of the hash index of the site table
+#endif
 
+#ifdef HEAPS_COMPACT_HEADER
+	#if (HEAPS_MAX_SITES > 0xFFFF)
+		#error "HEAPS_MAX_SITES may not be more than 65535 with HEAPS_COMPACT_HEADER"
+	#endif
+	#define COMPACT_UNIT		((intptr_t)__alignof__(heaps_t))
+	#define COMPACT_RANGE		((intptr_t)1 << 30)		// in units, from compact_base, so that any two allocations are within INT32_MAX units
+	#define NEXT_OF(meta)		((meta)->next ? (heaps_t*)((uint8_t*)(meta) + (meta)->next * COMPACT_UNIT) : NULL)
+	#define SET_NEXT(meta,to)	((meta)->next = (to) ? (int32_t)(((intptr_t)(to) - (intptr_t)(meta)) / COMPACT_UNIT) : 0)
+#else
+	#define NEXT_OF(meta)		((meta)->next)
+	#define SET_NEXT(meta,to)	((meta)->next = (to))
+#endif
 
-#ifdef heaps_platform_alloc
-static void* alloc_(size_t size, const char* file, int line)
-{
-	void* retval = NULL;
-	heaps_t* meta;
-	size_t size_with_meta = size + sizeof(heaps_t);
+	#ifndef HEAPS_WALK_CHECK_BUDGET
+		#define HEAPS_WALK_CHECK_BUDGET	0			// 0 walks every allocation on every operation
+	#endif
+	#ifndef HEAPS_PLATFORM_CHECK_INTERVAL
+		#define HEAPS_PLATFORM_CHECK_INTERVAL	1
+	#endif
 
-	check_heap(file, line);
-	meta = heaps_platform_alloc(size_with_meta);
-	if(meta == NULL)
-		heaps_error_handler("allocation failed", file, line);
-	else
-	{
-		retval = link_allocation(meta, size, file, line);
-		track_headroom();
-	};
+//	the walk is replaced by checksums, unless a budgeted walk is asked for, and is never done by the allocating threads when there is a checker thread
+	#if (defined HEAPS_NO_PRE_OPERATION_WALK_CHECK || (defined HEAPS_HEADER_CHECKSUM && HEAPS_WALK_CHECK_BUDGET == 0) || defined HEAPS_CHECKER_THREAD || defined SHARDED)
+		#define WALK_CHECK	0
+	#else
+		#define WALK_CHECK	1
+	#endif
 
-	return retval;
-}
+//	A hash table entry can be moved back past the walk's cursor when another is removed, and so be missed by the walk.
+	#ifdef HEAPS_HASH_TABLE
+		#define WALK_MISSED_PER_UNLINK	2
+	#else
+		#define WALK_MISSED_PER_UNLINK	1
+	#endif
+
+#ifdef HEAPS_HEADER_CHECKSUM
+	#define HEAPS_CHECK_MAGIC	((uint32_t)0x48454150)	// "HEAP"
+	#define SEALED(meta)		((meta) == NULL || (meta)->check == checksum(meta))
+	#define SEAL(meta)			do{if(meta) (meta)->check = checksum(meta);}while(0)
+#else
+	#define SEALED(meta)		(true)
+	#define SEAL(meta)			((void)(meta))
+#endif
+
+#ifdef HEAPS_HASH_TABLE
+	#ifndef HEAPS_HASH_TABLE_MIN
+		#define HEAPS_HASH_TABLE_MIN	64		// must be a power of 2
+	#endif
+
+//	memory used by heaps itself is taken directly from the platform, and not tracked
+	#ifdef heaps_platform_alloc
+		#define platform_alloc_untracked(size)	PLATFORM_ALLOC(size)
+	#else
+		#define platform_alloc_untracked(size)	PLATFORM_REALLOC(NULL, size)
+	#endif
+#endif
+
+#ifdef HEAPS_SIDE_TABLE
+	#ifndef HEAPS_SIDE_TABLE_GRANULE
+		#define HEAPS_SIDE_TABLE_GRANULE	__BIGGEST_ALIGNMENT__
+	#endif
+	#define SIDE_ENTRIES		(HEAPS_SIDE_TABLE_SPAN / HEAPS_SIDE_TABLE_GRANULE)
+	#define WITH_HEADER(size)	((size) != 0 ? (size) : 1)		// without a header a 0 byte allocation still asks for a byte, so the allocator can't refuse it
+	#define CONTENT_OF(meta)	((void*)((uint8_t*)heaps_platform_base() + ((meta) - side_table) * HEAPS_SIDE_TABLE_GRANULE))
+	#define META_OF_BLOCK(block)	side_entry(block)
+	#ifdef HEAPS_STATIC_SITES
+		#define SIDE_USED(meta)		((meta)->site != NULL)
+	#else
+		#define SIDE_USED(meta)		((meta)->file != NULL)
+	#endif
+#else
+//	get the heaps_t from it's content[] member
+	#define META_OF(ptr)		((heaps_t*)((uint8_t*)(ptr) - offsetof(heaps_t, content)))
+	#define WITH_HEADER(size)	((size) + sizeof(heaps_t))
+	#define CONTENT_OF(meta)	((void*)(meta)->content)
+	#define META_OF_BLOCK(block)	((heaps_t*)(block))
+#endif
+
+#ifdef HEAPS_DOUBLY_LINKED
+//	the tag expected for a linked heaps_t at a given address, this is cleared when unlinked to catch double frees
+	#define HEAPS_TAG_KEY	((uintptr_t)0x68656170)	// "heap"
+	#define TAG_OF(meta)	((uintptr_t)(meta) ^ HEAPS_TAG_KEY)
+#endif
+
+#ifdef HEAPS_SAMPLING
+//	the tag of an unsampled allocation's header, the key's high bits are set so that it isn't a plausible pointer on 64bit platforms
+	#define STUB_TAG_KEY		(~(uintptr_t)0x73616D70)	// ~"samp"
+	#define STUB_TAG(stub)		((uintptr_t)(stub) ^ STUB_TAG_KEY)
+	#define STUB_OF(ptr)		((stub_t*)((uint8_t*)(ptr) - offsetof(stub_t, content)))
+	#define STUB_SIZE			sizeof(stub_t)
+	#define STUB_BLOCK_SIZE(stub)	(((stub_t*)(stub))->size + STUB_SIZE)
+	#define SAMPLE_LOG2_E		1.4426950408889634
+	#define SAMPLE_SEED			0x1234ABCD330EULL		// that of drand48(), a seed of 0 gives a run of very small numbers first
+#endif
+
+#ifdef HEAPS_SAMPLING
+//	The header of an allocation which wasn't sampled, the tag is cleared when it is freed to catch double frees
+	typedef struct stub_t
+	{
+		size_t			size;
+		uintptr_t		tag;
+		uint8_t			content[0] __attribute__((aligned));
+	} stub_t;
+#endif
+
+//	The allocations, and the state of the pre-operation walk over them, which may be spread over many operations
+	typedef struct shard_t
+	{
+	#ifdef LINKED_LIST
+		heaps_t* 	head;
+		heaps_t* 	walk_cursor;		// the next allocation to be visited
+	#else
+		size_t		walk_slot;
+	#endif
+		int			count;				// allocations linked
+		bool		walk_in_pass;
+		heaps_t* 	walk_last;			// the last intact allocation visited in this pass, if it is still linked
+		int 		walk_visited;		// allocations visited in this pass
+		int 		walk_expected;		// count when the pass started
+		int 		walk_linked;		// allocations linked since the pass started
+		int 		walk_unlinked;		// allocations unlinked since the pass started
+		size_t 		walk_passes;
+	#ifdef HEAPS_PER_THREAD
+		heaps_t*	remote;				// allocations freed by other threads, the last one's remote_next points to itself
+		bool		busy;				// held by the owner while it allocates or frees, or by a report or heaps_check_step()
+		bool		owned;				// taken by a thread which hasn't exited
+	#endif
+	} shard_t;
+
+#ifdef HEAPS_SLAB
+//	The blocks of one size class
+	typedef struct slab_t
+	{
+		void*		free;			// freed blocks, linked through their first word
+		uint8_t*	carve;			// the next block never handed out, in the newest chunk of this class
+		uint8_t*	carve_end;
+	} slab_t;
+#endif
+
+#ifdef HEAPS_THREAD_CACHE
+//	The blocks a thread has freed, for it to reuse
+	typedef struct cache_t
+	{
+		void*		head[SLAB_CLASSES];		// a list for each class, linked through their first word
+		unsigned	count[SLAB_CLASSES];
+		unsigned	hits;					// not yet added to the totals
+		unsigned	misses;
+		bool		registered;				// the thread's exit will flush it
+	} cache_t;
+#endif
+
+//	A report being gathered into buf, or with selecting, a pass of heaps_report_foreach() gathering the first source locations after after
+	typedef struct report_t
+	{
+		heaps_report_t*	buf;
+		int				capacity;
+		int				size;
+		bool			full;			// a source location didn't fit
+		bool			selecting;
+		heaps_report_t	after;			// file is NULL for the first pass
+		heaps_t*		own;			// heaps_report()'s own allocation, which is left out of the walk and added last
+	#ifdef HEAPS_SITE_PEAKS
+		bool			idle;			// include sites with no allocations now
+	#endif
+	} report_t;
+
+#ifdef HEAPS_TRACE
+//	Written only by the thread which owns it, and read only by heaps_trace_drain()
+	typedef struct trace_ring_t
+	{
+		heaps_trace_event_t	events[HEAPS_TRACE_EVENTS];
+		size_t				head;		// events written, accessed atomically
+		size_t				tail;		// events drained, accessed atomically
+		bool				owned;		// taken by a thread
+	} trace_ring_t;
+#endif
+
+//	The first ARENA_ALIGN bytes of each chunk link it to the previous one
+	struct heaps_arena_t
+	{
+		const char*	file;			// where the arena was created, it's chunks are allocated from there
+		int			line;
+		size_t		chunk_size;
+		uint8_t*	chunks;			// the newest chunk
+		uint8_t*	bump;			// the next free byte in the newest chunk
+		uint8_t*	end;
+		int			count;			// allocations made from the arena, written only by the thread using it, and read by reports
+		size_t		size;			// and their total size
+		heaps_arena_t*	next;		// the arena created before it, in the instance's list of live arenas
+	};
+
+//	Everything about one tracked heap
+#ifndef HEAPS_INSTANCES
+	typedef struct heaps_instance_t heaps_instance_t;
+#endif
+	struct heaps_instance_t
+	{
+	#ifdef HEAPS_INSTANCES
+		heaps_backend_t	backend;
+	#endif
+	#ifdef HEAPS_HASH_TABLE
+		void**			table;					// content pointers of all allocations, NULL for empty slots
+		size_t			table_capacity;			// always 0 or a power of 2
+	#endif
+		int				allocation_count;
+		int				allocation_count_peak;
+		size_t			headroom;
+		heaps_report_t	largest_allocation;
+		heaps_stats_t	stats;
+		heaps_arena_t*	arenas;					// the live arenas, newest first
+	#ifdef SHARDED
+		bool			arenas_busy;			// held while the arenas are linked, unlinked or reported
+	#endif
+	#ifdef HEAPS_ATOMIC_STATS
+		unsigned		largest_seq;			// odd while largest_allocation is being updated
+	#endif
+		shard_t			shards[SHARD_COUNT];
+	#ifdef SHARDED
+		unsigned		shard_to_check;			// the shard heaps_check_step() walks next, accessed atomically
+	#endif
+	#if (HEAPS_PLATFORM_CHECK_INTERVAL > 1)
+		int				platform_check_countdown;
+	#endif
+	#ifdef HEAPS_SLAB
+		slab_t			slabs[SLAB_CLASSES];
+		void*			slab_chunks;			// every chunk taken from the platform, linked through their first word
+	#endif
+	#ifdef HEAPS_SAMPLING
+		int64_t			sample_countdown;		// bytes to be allocated before the next sample, the first allocation is always sampled
+		uint64_t		sample_random;			// state of the sampler's random number generator
+		int				unsampled;				// allocations with only a stub_t
+	#endif
+	};
+
+//********************************************************************************************************
+// Private variables
+//********************************************************************************************************
+
+#ifdef HEAPS_SIDE_TABLE
+	static heaps_t side_table[SIDE_ENTRIES];	// one entry per granule of the allocator's region, unused entries are all 0
+#endif
+
+#ifdef HEAPS_INSTANCES
+//	The default instance's backend, calling the heaps_platform_ functions
+	static void* default_alloc(void* context, size_t size);
+	static void* default_realloc(void* context, void* ptr, size_t size);
+	static void default_free(void* context, void* ptr);
+	static bool default_check(void* context);
+	static size_t default_largest_free(void* context);
+	static void default_lock(void* context);
+	static void default_unlock(void* context);
+#endif
+
+	static heaps_instance_t default_instance =
+	{
+	#ifdef HEAPS_INSTANCES
+		.backend =
+		{
+		#ifdef heaps_platform_alloc
+			.alloc = default_alloc,
+		#endif
+		#ifdef heaps_platform_realloc
+			.realloc = default_realloc,
+		#endif
+			.free = default_free,
+			.check = default_check,
+			.largest_free = default_largest_free,
+			.lock = default_lock,
+			.unlock = default_unlock,
+		},
+	#endif
+		.headroom = (size_t)-1,
+	#ifdef HEAPS_SAMPLING
+		.sample_random = SAMPLE_SEED,
+	#endif
+	};
+#ifdef HEAPS_INSTANCES
+	static __thread heaps_instance_t* instance;	// the instance whose lock is held by this thread
+#else
+	static heaps_instance_t* const instance = &default_instance;
+#endif
+
+#ifdef SHARDED
+	static __thread shard_t* shard;		// the shard whose lock is held by this thread
+#endif
+#ifdef HEAPS_PER_THREAD
+	static __thread shard_t* own_shard;	// the list taken by this thread, NULL until it first allocates
+	static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+	static pthread_key_t thread_key;		// gives up own_shard when the thread exits
+#endif
+#ifdef HEAPS_THREAD_CACHE
+	static __thread cache_t cache;
+	static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+	static pthread_key_t cache_key;			// flushes the cache when the thread exits
+	static size_t cache_hits = 0;			// the counts added by every thread, accessed atomically
+	static size_t cache_misses = 0;
+#endif
+#ifdef HEAPS_TRACE
+	static trace_ring_t trace_rings[HEAPS_TRACE_THREADS];
+	static __thread trace_ring_t* own_ring;	// the ring taken by this thread, NULL until it first traces
+	static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+	static pthread_key_t trace_key;			// gives up own_ring when the thread exits
+	static uint64_t trace_clock = 0;		// events traced by every thread, when there is no heaps_platform_time()
+	static size_t trace_dropped = 0;
+#endif
+#if (defined HEAPS_INSTANCES && !defined SHARDED)
+	static __thread shard_t* shard;		// the only shard of the instance this thread works on
+#elif (!defined SHARDED)
+	static shard_t* const shard = &default_instance.shards[0];
+#endif
+
+#ifdef HEAPS_SITE_COUNTERS
+	static heaps_site_t site_overflow = {.file = __FILE__, .line = __LINE__, .index = HEAPS_MAX_SITES+1};	// counts allocations which didn't fit in the table
+	static heaps_site_t* sites[HEAPS_MAX_SITES+1] = {[HEAPS_MAX_SITES] = &site_overflow};	// every site which has been used, in the order of first use
+	static int site_count = 0;
+	static heaps_site_t site_pool[HEAPS_MAX_SITES];	// sites for source locations which weren't given a static descriptor
+	static int site_pool_count = 0;
+	static int site_slots[SITE_SLOTS];				// index+1 of a site in site_pool[], 0 for an empty slot
+#endif
+
+#ifdef HEAPS_COMPACT_HEADER
+	static uintptr_t compact_base = 0;				// the first allocation, all others must be within COMPACT_RANGE of it
+#endif
+
+#ifdef HEAPS_SAMPLING
+	static size_t sample_interval = HEAPS_SAMPLING;
+#endif
+
+#ifdef HEAPS_CHECKER_THREAD
+	static pthread_t checker_thread;
+	static bool checker_running = false;	// accessed atomically
+	static unsigned long checker_interval_us;
+#endif
+
+//********************************************************************************************************
+// Private prototypes
+//********************************************************************************************************
+
+//	site is the static descriptor of the source location with HEAPS_STATIC_SITES, or NULL to find it from file and line
+	static void* alloc_(size_t size, heaps_site_t* site, const char* file, int line);
+	static void* realloc_(void* ptr, size_t size, heaps_site_t* site, const char* file, int line);
+	static void* free_(void* ptr, const char* file, int line);
+	static void* calloc_(size_t qty, size_t size, heaps_site_t* site, const char* file, int line);
+	static size_t alloc_batch(const size_t* sizes, size_t n, void** ptrs, heaps_site_t* site, const char* file, int line);
+	static void free_batch(void** ptrs, size_t n, const char* file, int line);
+
+//	Allocate a chunk of size bytes for an arena (taking the lock), and link it in front of it's others, or after the newest if it is to
+//	hold a single allocation, so the newest can still be bumped through. Returns the first byte after the link, or NULL if that fails.
+	static uint8_t* arena_chunk(heaps_arena_t* arena, size_t size, bool single);
+
+
+	static void check_heap(const char* file, int line);
+
+//	The statistics, checks and lists of the current instance
+	static int get_count(void);
+	static int get_count_peak(void);
+	static size_t get_headroom(void);
+	static heaps_report_t get_largest(void);
+	static heaps_stats_t get_stats(void);
+	static size_t get_walk_passes(void);
+	static bool check_step(void);
+	static heaps_t* allocation_list(void);
+	static heaps_t* next_allocation(heaps_t* link);
+
+//	Visit up to HEAPS_WALK_CHECK_BUDGET allocations (or all of them) continuing the current pass, or starting a new one.
+//	Returns false if the meta data was found to be broken.
+	static bool walk_check(void);
+	static void walk_start(void);
+
+//	Call heaps_platform_check() if it is due (see HEAPS_PLATFORM_CHECK_INTERVAL), returns false if it was called and failed.
+	static bool platform_check(void);
+
+#ifdef HEAPS_CHECKER_THREAD
+	static void* checker_main(void* arg);
+#endif
+
+#ifdef HEAPS_SHARDS
+//	Return the shard of an allocation, from the address of it's heaps_t
+	static unsigned shard_index(void* block);
+#endif
+
+#ifdef SHARDED
+//	Take the lock of a shard, and make it the one this thread works on, or release it
+	static void shard_enter(unsigned index);
+	static void shard_leave(void);
+
+//	Return the head of the first shard at or after index with any allocations, or NULL
+	static heaps_t* shard_scan(unsigned index);
+#endif
+
+#ifdef HEAPS_PER_THREAD
+//	Take a list which no running thread has, returns false if all are taken
+	static bool thread_claim(void);
+	static void thread_key_create(void);
+	static void thread_exit(void* state);
+
+//	Returns true if ptr is a valid allocation made by another thread
+	static bool is_remote(void* ptr);
+
+//	Queue an allocation made by another thread, to be unlinked and freed by it. Always returns NULL, as there is nothing for the caller to free.
+	static void* remote_free(heaps_t* meta, const char* false_free_msg, const char* file, int line);
+
+//	Unlink and free the allocations queued for the current shard
+	static void remote_drain(void);
+#endif
+
+//	Given a block from the platform allocator, fill out the members of it's heaps_t, link it, and return it's content
+//	Returns NULL if the allocation could not be linked, the caller must then free block.
+	static void* link_allocation(void* block, size_t size, heaps_site_t* site, const char* file, int line);
+
+//	Given a void* to be freed, find it's heaps_t, unlink it, and return the address to free.
+//	Returns NULL if the given ptr is not a value previously returned by heaps_alloc(), in which case the error handler is called
+//	with false_free_msg (unless it is NULL), or with "heap broken" if a heaps_t was found to be corrupt.
+	static void* unlink_allocation(void* ptr, const char* false_free_msg, const char* file, int line);
+
+#ifdef HEAPS_SIDE_TABLE
+//	Return the side table entry for a block, or NULL if it is outside the table or the entry is in use
+	static heaps_t* side_entry(void* block);
+
+//	Return the side table entry of a content pointer, or NULL if it isn't a current allocation
+	static heaps_t* side_find(void* ptr);
+
+//	Return the first used entry at or after index, or NULL
+	static heaps_t* side_scan(size_t index);
+#endif
+
+#ifdef CLASSED
+//	Allocate, reallocate or free a block, from it's size class if it is small enough, or the platform if not.
+//	slab_realloc() moves a block between classes (or to or from the platform), returning NULL and leaving it as it was if that fails.
+	static void* slab_alloc(size_t size);
+	static void* slab_realloc(void* block, size_t old_size, size_t size);
+	static void slab_free(void* block, size_t size);
+
+//	Return the size class of a block of up to HEAPS_SLAB_MAX bytes, and the block size of a class
+	static unsigned slab_class(size_t size);
+	static size_t slab_size(unsigned class);
+
+//	Take a block of a class from it's list or a chunk with HEAPS_SLAB, or from the platform without, or give one back
+	static void* slab_take(unsigned class);
+	static void slab_release(void* block, unsigned class);
+#endif
+
+#ifdef HEAPS_SLAB
+//	Take a new chunk from the platform to carve blocks of a class from, returns false if that fails
+	static bool slab_grow(slab_t* slab);
+#endif
+
+#ifdef HEAPS_THREAD_CACHE
+//	Pop a block of a class from this thread's magazine, or return NULL if it is empty
+	static void* cache_pop(unsigned class);
+
+//	Push a block onto this thread's magazine for it's class, returns false if that is full
+	static bool cache_push(void* block, unsigned class);
+
+//	Release every block in this thread's magazines, the lock must be held
+	static void cache_flush(void);
+
+//	Add this thread's hit and miss counts to the totals
+	static void cache_publish(void);
+	static void cache_key_create(void);
+	static void cache_exit(void* state);
+#endif
+
+#ifdef HEAPS_SAMPLING
+//	Count size bytes towards the next sample, returns true if the allocation is to be sampled
+	static bool sample_pick(size_t size);
+
+//	Return the bytes to be allocated before the next sample, drawn from an exponential distribution with a mean of sample_interval
+	static int64_t sample_gap(void);
+
+//	Scale the counts and sizes of a report to estimates for every allocation, and fill in their errors
+	static void sample_scale(heaps_report_t* arr, int arr_size);
+
+//	Return the chance that an allocation of size bytes is sampled
+	static double sample_chance(double size);
+
+//	Approximations of log2(x) for x >= 1, 2^x for x <= 0, and sqrt(x), good to about 5 significant figures
+	static double sample_log2(double x);
+	static double sample_exp2(double x);
+	static double sample_sqrt(double x);
+
+//	Allocate an unsampled allocation and fill out it's stub_t, calling the error handler with fail_msg if that fails.
+//	The caller must count it.
+	static void* stub_alloc(size_t size, const char* fail_msg, const char* file, int line);
+
+//	Return the stub_t of ptr if it is an unsampled allocation, or NULL
+	static stub_t* stub_find(void* ptr);
+
+//	If ptr is an unsampled allocation, stop counting it and return it's stub_t (the block to free), or return NULL
+	static stub_t* stub_unlink(void* ptr);
+
+//	Allocate, free or resize an unsampled allocation for realloc_(). Returns false if it is for a sampled allocation instead.
+	static bool stub_realloc(void** retval, void* ptr, size_t size, const char* file, int line);
+#endif
+
+#ifdef HEAPS_COMPACT_HEADER
+//	Return true if meta can be reached by an offset from any other allocation (NULL can always be reached)
+	static bool compact_reachable(heaps_t* meta);
+#endif
+
+#ifdef HEAPS_HEADER_CHECKSUM
+//	Checksum all the members of a heaps_t, other than check
+	static uint32_t checksum(heaps_t* meta);
+	static uint32_t checksum_word(uint32_t sum, uintptr_t word);
+#endif
+
+#ifdef HEAPS_DOUBLY_LINKED
+//	Return true if ptr is the content of a currently linked heaps_t, without walking the list.
+	static bool is_linked(void* ptr);
+
+//	Unlink an allocation known to be linked in the current shard, the caller has already stopped counting it
+	static void unlink_linked(heaps_t* meta);
+#endif
+
+#ifdef HEAPS_HASH_TABLE
+//	Return the home slot of a content pointer
+	static size_t table_hash(void* ptr);
+
+//	Return the slot holding ptr, or table_capacity if it is not in the table
+	static size_t table_find(void* ptr);
+
+//	Insert a content pointer, there must be at least one empty slot
+	static void table_insert(void* ptr);
+
+//	Empty a slot, shifting back any following entries which would no longer be reachable from their home slot
+	static void table_remove(size_t slot);
+
+//	Grow or shrink the table as needed before adding an entry. Returns false if there is no room for another entry.
+	static bool table_make_room(void);
+
+//	Rehash into a new table of new_capacity slots. Returns false (leaving the table unchanged) if the new table can't be allocated.
+	static bool table_resize(size_t new_capacity);
+
+//	Return the allocation in the first used slot at or after slot, or NULL
+	static heaps_t* table_scan(size_t slot);
+#endif
+
+	static void track_headroom(void);
+
+//	Count an allocation being linked or unlinked, and raise the peak allocation count if needed
+	static void track_count(int change);
+
+//	Account for an allocation of size bytes being linked (change 1) or unlinked (change -1)
+	static void track_bytes(int change, size_t size);
+
+//	The histogram bin of an allocation of size bytes
+	static unsigned size_bin(size_t size);
+
+//	Record the largest allocation, if size is larger than it
+	static void track_largest(size_t size, const char* file, int line);
+
+//	Update the statistics after count allocations were linked, the largest of them being largest bytes
+	static void track_linked(int count, size_t largest, const char* file, int line);
+
+//	Allocate and gather a report, gather one into a buffer, or gather one a pass at a time for a callback
+	static heaps_report_t* report(int* arr_size);
+	static bool report_into(heaps_report_t* buf, int capacity, int* arr_size);
+#ifdef HEAPS_SITE_PEAKS
+	static bool report_peaks(heaps_report_t* buf, int capacity, int* arr_size);
+#endif
+	static void report_foreach(heaps_instance_t* inst, heaps_report_callback_t callback, void* context);
+
+//	Add every allocation (or site with HEAPS_SITE_COUNTERS) of the current instance to a report
+	static void report_visit(report_t* r);
+	static void report_add(report_t* r, heaps_report_t entry);
+
+//	Add the allocations made from the current instance's arenas to the entries for their source locations
+	static void report_arenas(report_t* r);
+
+//	Compare a source location with a report entry's, by file name then line, and sort entries in that order
+	static int report_order(const char* file, int line, const heaps_report_t* entry);
+	static void report_sort(heaps_report_t* arr, int arr_size);
+
+#if (defined HEAPS_SITE_COUNTERS || defined HEAPS_TRACE)
+//	FNV-1a over the file name, then the line
+	static uint32_t location_hash(const char* file, int line);
+#endif
+
+#ifdef HEAPS_TRACE
+//	Write an event to this thread's ring, taking one if it doesn't have one yet
+	static void trace(heaps_trace_op_t op, void* ptr, void* old, size_t size, const char* file, int line);
+	static bool trace_claim(void);
+	static void trace_key_create(void);
+	static void trace_exit(void* ring);
+	static size_t trace_drain(heaps_trace_event_t* buf, size_t capacity);
+#endif
+
+//	Remove an allocation being unlinked from the count and size of it's site (and record it's lifetime)
+	static void unlink_site(heaps_t* meta);
+
+#ifdef HEAPS_LIFETIMES
+//	The allocations made so far, and the lifetime histogram bin of an allocation being unlinked
+	static uint32_t lifetime_clock(void);
+	static unsigned lifetime_bin(heaps_t* meta);
+#endif
+
+#ifdef HEAPS_SITE_COUNTERS
+//	Find the site for a source location, adding it to the table if it isn't there
+	static heaps_site_t* site_find(const char* file, int line);
+	static size_t site_hash(const char* file, int line);
+
+//	Add a site to the table if it isn't already there, returns the site to count allocations against
+	static heaps_site_t* site_register(heaps_site_t* site);
+
+//	Count change allocations of size bytes in total being linked (or unlinked if change is negative) against a site
+	static void site_track(heaps_site_t* site, int change, size_t size);
+#endif
+
+#ifdef HEAPS_LOCK_FREE_REPORT
+//	Copy the sites to buf without taking the lock, returns false if they didn't fit
+	static bool report_snapshot(heaps_report_t* buf, int capacity, int* arr_size);
+
+//	Copy a site to a report entry, retrying if it's counts are updated meanwhile
+	static void site_read(heaps_site_t* site, heaps_report_t* entry);
+#endif
+
+//********************************************************************************************************
+// Public functions
+//********************************************************************************************************
+
+#ifdef heaps_platform_alloc
+STATIC_IF_SANDBOXED void* heaps_alloc_(size_t size, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = alloc_(size, NULL, file, line);
+	INSTANCE_LEAVE();
+	TRACE(HEAPS_TRACE_ALLOC, retval, NULL, size, file, line);
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_realloc
+STATIC_IF_SANDBOXED void* heaps_realloc_(void* ptr, size_t size, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = realloc_(ptr, size, NULL, file, line);
+	INSTANCE_LEAVE();
+	TRACE(HEAPS_TRACE_REALLOC, retval, ptr, size, file, line);
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_free
+STATIC_IF_SANDBOXED void* heaps_free_(void* ptr, const char* file, int line)
+{
+	void* retval;
+	if(ptr)
+		TRACE(HEAPS_TRACE_FREE, ptr, NULL, 0, file, line);
+	INSTANCE_ENTER(&default_instance);
+	retval = free_(ptr, file, line);
+	INSTANCE_LEAVE();
+	return retval;
+}
+#endif
+
+#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
+STATIC_IF_SANDBOXED void* heaps_calloc_(size_t qty, size_t size, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = calloc_(qty, size, NULL, file, line);
+	INSTANCE_LEAVE();
+	TRACE(HEAPS_TRACE_CALLOC, retval, NULL, qty*size, file, line);
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_alloc
+STATIC_IF_SANDBOXED size_t heaps_alloc_batch_(const size_t* sizes, size_t n, void** ptrs, const char* file, int line)
+{
+	size_t retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = alloc_batch(sizes, n, ptrs, NULL, file, line);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_TRACE
+	for(n = 0; n != retval; n++)
+		trace(HEAPS_TRACE_ALLOC, ptrs[n], NULL, sizes[n], file, line);
+#endif
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_free
+STATIC_IF_SANDBOXED void heaps_free_batch_(void** ptrs, size_t n, const char* file, int line)
+{
+#ifdef HEAPS_TRACE
+	size_t i;
+	for(i = 0; i != n; i++)
+	{
+		if(ptrs[i])
+			trace(HEAPS_TRACE_FREE, ptrs[i], NULL, 0, file, line);
+	};
+#endif
+	INSTANCE_ENTER(&default_instance);
+	free_batch(ptrs, n, file, line);
+	INSTANCE_LEAVE();
+}
+#endif
+
+#ifdef heaps_platform_alloc
+STATIC_IF_SANDBOXED heaps_arena_t* heaps_arena_create_(size_t chunk_size, const char* file, int line)
+{
+	heaps_arena_t* arena;
+	INSTANCE_ENTER(&default_instance);
+	arena = alloc_(sizeof(heaps_arena_t), NULL, file, line);
+	if(arena)
+	{
+		ARENAS_LOCK();
+		*arena = (heaps_arena_t){.file = file, .line = line, .chunk_size = ARENA_ROUND(chunk_size) + ARENA_ALIGN, .next = instance->arenas};
+		instance->arenas = arena;
+		ARENAS_UNLOCK();
+	};
+	INSTANCE_LEAVE();
+	return arena;
+}
+
+STATIC_IF_SANDBOXED void* heaps_arena_alloc(heaps_arena_t* arena, size_t size)
+{
+	uint8_t* retval = NULL;
+	size_t rounded = ARENA_ROUND(size ? size : 1);
+
+	if(size > ARENA_LARGEST)
+		heaps_error_handler("allocation failed", arena->file, arena->line);
+	else if(rounded <= (size_t)(arena->end - arena->bump))
+	{
+		retval = arena->bump;
+		arena->bump += rounded;
+	}
+	else if(rounded > arena->chunk_size - ARENA_ALIGN)
+		retval = arena_chunk(arena, rounded + ARENA_ALIGN, true);
+	else if((retval = arena_chunk(arena, arena->chunk_size, false)) != NULL)
+		arena->bump += rounded;
+
+	if(retval)
+	{
+		__atomic_store_n(&arena->count, arena->count + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&arena->size, arena->size + size, __ATOMIC_RELAXED);
+	};
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_free
+STATIC_IF_SANDBOXED void heaps_arena_destroy(heaps_arena_t* arena)
+{
+	uint8_t* chunk;
+	heaps_arena_t** link;
+
+	INSTANCE_ENTER(&default_instance);
+	ARENAS_LOCK();
+	for(link = &instance->arenas; *link != arena; link = &(*link)->next);
+	*link = arena->next;
+	ARENAS_UNLOCK();
+	while((chunk = arena->chunks) != NULL)
+	{
+		arena->chunks = *(uint8_t**)chunk;
+		free_(chunk, arena->file, arena->line);
+	};
+	free_(arena, arena->file, arena->line);
+	INSTANCE_LEAVE();
+}
+#endif
+
+STATIC_IF_SANDBOXED heaps_report_t heaps_arena_report(heaps_arena_t* arena)
+{
+	return (heaps_report_t){.file = arena->file, .line = arena->line, .count = arena->count, .size = arena->size};
+}
+
+#if (defined HEAPS_STATIC_SITES && defined heaps_platform_alloc)
+STATIC_IF_SANDBOXED void* heaps_alloc_site_(size_t size, heaps_site_t* site)
+{
+	void* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = alloc_(size, site, site->file, site->line);
+	INSTANCE_LEAVE();
+	TRACE(HEAPS_TRACE_ALLOC, retval, NULL, size, site->file, site->line);
+	return retval;
+}
+#endif
+
+#if (defined HEAPS_STATIC_SITES && defined heaps_platform_realloc)
+STATIC_IF_SANDBOXED void* heaps_realloc_site_(void* ptr, size_t size, heaps_site_t* site)
+{
+	void* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = realloc_(ptr, size, site, site->file, site->line);
+	INSTANCE_LEAVE();
+	TRACE(HEAPS_TRACE_REALLOC, retval, ptr, size, site->file, site->line);
+	return retval;
+}
+#endif
+
+#if (defined HEAPS_STATIC_SITES && (defined heaps_platform_alloc || defined heaps_platform_realloc))
+STATIC_IF_SANDBOXED void* heaps_calloc_site_(size_t qty, size_t size, heaps_site_t* site)
+{
+	void* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = calloc_(qty, size, site, site->file, site->line);
+	INSTANCE_LEAVE();
+	TRACE(HEAPS_TRACE_CALLOC, retval, NULL, qty*size, site->file, site->line);
+	return retval;
+}
+#endif
+
+#if (defined HEAPS_STATIC_SITES && defined heaps_platform_alloc)
+STATIC_IF_SANDBOXED size_t heaps_alloc_batch_site_(const size_t* sizes, size_t n, void** ptrs, heaps_site_t* site)
+{
+	size_t retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = alloc_batch(sizes, n, ptrs, site, site->file, site->line);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_TRACE
+	for(n = 0; n != retval; n++)
+		trace(HEAPS_TRACE_ALLOC, ptrs[n], NULL, sizes[n], site->file, site->line);
+#endif
+	return retval;
+}
+#endif
+
+#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
+STATIC_IF_SANDBOXED heaps_report_t* heaps_report(int* arr_size)
+{
+	heaps_report_t* retval;
+	INSTANCE_ENTER(&default_instance);
+	retval = report(arr_size);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_SAMPLING
+	sample_scale(retval, arr_size ? *arr_size : 0);
+#endif
+	return retval;
+}
+#endif
+
+STATIC_IF_SANDBOXED bool heaps_report_into(heaps_report_t* buf, int capacity, int* arr_size)
+{
+	bool retval;
+	int size;
+	INSTANCE_ENTER(&default_instance);
+	retval = report_into(buf, capacity, &size);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_SAMPLING
+	sample_scale(buf, size);
+#endif
+	if(arr_size)
+		*arr_size = size;
+	return retval;
+}
+
+#ifdef HEAPS_SITE_PEAKS
+STATIC_IF_SANDBOXED bool heaps_report_peaks(heaps_report_t* buf, int capacity, int* arr_size)
+{
+	bool retval;
+	int size;
+	INSTANCE_ENTER(&default_instance);
+	retval = report_peaks(buf, capacity, &size);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_SAMPLING
+	sample_scale(buf, size);
+#endif
+	if(arr_size)
+		*arr_size = size;
+	return retval;
+}
+#endif
+
+STATIC_IF_SANDBOXED void heaps_report_foreach(heaps_report_callback_t callback, void* context)
+{
+	report_foreach(&default_instance, callback, context);
+}
+
+#ifdef HEAPS_LOCK_FREE_REPORT
+STATIC_IF_SANDBOXED bool heaps_report_snapshot(heaps_report_t* buf, int capacity, int* arr_size)
+{
+	bool retval;
+	int size;
+	retval = report_snapshot(buf, capacity, &size);
+#ifdef HEAPS_SAMPLING
+	sample_scale(buf, size);
+#endif
+	if(arr_size)
+		*arr_size = size;
+	return retval;
+}
+#endif
+
+STATIC_IF_SANDBOXED int heaps_report_sorter_descending_count(const void* a, const void* b)
+{
+	return ((heaps_report_t*)b)->count - ((heaps_report_t*)a)->count;
+}
+
+STATIC_IF_SANDBOXED int heaps_report_sorter_descending_size(const void* a, const void* b)
+{
+	return ((heaps_report_t*)b)->size - ((heaps_report_t*)a)->size;
+}
+
+STATIC_IF_SANDBOXED int heaps_get_allocation_count(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return get_count();
+}
+
+STATIC_IF_SANDBOXED int heaps_get_allocation_count_peak(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return get_count_peak();
+}
+
+STATIC_IF_SANDBOXED size_t heaps_get_headroom(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return get_headroom();
+}
+
+STATIC_IF_SANDBOXED heaps_report_t heaps_get_largest_allocation(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return get_largest();
+}
+
+STATIC_IF_SANDBOXED heaps_stats_t heaps_get_stats(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return get_stats();
+}
+
+STATIC_IF_SANDBOXED size_t heaps_get_walk_pass_count(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return get_walk_passes();
+}
+
+STATIC_IF_SANDBOXED bool heaps_check_step(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return check_step();
+}
+
+#ifdef HEAPS_CHECKER_THREAD
+
+STATIC_IF_SANDBOXED bool heaps_checker_start(unsigned long interval_us)
+{
+	bool started = false;
+	if(!__atomic_load_n(&checker_running, __ATOMIC_ACQUIRE))
+	{
+		checker_interval_us = interval_us;
+		__atomic_store_n(&checker_running, true, __ATOMIC_RELEASE);
+		started = !pthread_create(&checker_thread, NULL, checker_main, NULL);
+		if(!started)
+			__atomic_store_n(&checker_running, false, __ATOMIC_RELEASE);
+	};
+	return started;
+}
+
+STATIC_IF_SANDBOXED void heaps_checker_stop(void)
+{
+	if(__atomic_exchange_n(&checker_running, false, __ATOMIC_ACQ_REL))
+		pthread_join(checker_thread, NULL);
+}
+
+#endif
+
+#ifdef HEAPS_THREAD_CACHE
+
+STATIC_IF_SANDBOXED size_t heaps_get_cache_hit_count(void)
+{
+	return __atomic_load_n(&cache_hits, __ATOMIC_RELAXED);
+}
+
+STATIC_IF_SANDBOXED size_t heaps_get_cache_miss_count(void)
+{
+	return __atomic_load_n(&cache_misses, __ATOMIC_RELAXED);
+}
+
+STATIC_IF_SANDBOXED void heaps_cache_flush(void)
+{
+	INSTANCE_ENTER(&default_instance);
+	cache_flush();
+	INSTANCE_LEAVE();
+}
+
+#endif
+
+#ifdef HEAPS_SAMPLING
+
+STATIC_IF_SANDBOXED void heaps_set_sampling_interval(size_t bytes)
+{
+	sample_interval = bytes;
+	default_instance.sample_countdown = 0;
+}
+
+STATIC_IF_SANDBOXED size_t heaps_get_sampling_interval(void)
+{
+	return sample_interval;
+}
+
+#endif
+
+#ifdef HEAPS_TRACE
+
+STATIC_IF_SANDBOXED size_t heaps_trace_drain(heaps_trace_event_t* buf, size_t capacity)
+{
+	return trace_drain(buf, capacity);
+}
+
+STATIC_IF_SANDBOXED size_t heaps_trace_dropped(void)
+{
+	return __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+}
+
+STATIC_IF_SANDBOXED uint16_t heaps_trace_site(const char* file, int line)
+{
+	uint32_t hash = location_hash(file, line);
+	return (uint16_t)(hash ^ (hash >> 16));
+}
+
+#endif
+
+STATIC_IF_SANDBOXED heaps_t* heaps_get_allocation_list(void)
+{
+	INSTANCE_SELECT(&default_instance);
+	return allocation_list();
+}
+
+STATIC_IF_SANDBOXED heaps_t* heaps_get_next_allocation(heaps_t* link)
+{
+	INSTANCE_SELECT(&default_instance);
+	return next_allocation(link);
+}
+
+#ifdef HEAPS_SIDE_TABLE
+STATIC_IF_SANDBOXED void* heaps_get_content(heaps_t* link)
+{
+	return CONTENT_OF(link);
+}
+#endif
+
+#ifdef HEAPS_COMPACT_HEADER
+STATIC_IF_SANDBOXED heaps_site_t* heaps_get_site(heaps_t* link)
+{
+	return sites[link->site];
+}
+#endif
+
+#ifdef HEAPS_INSTANCES
+
+STATIC_IF_SANDBOXED heaps_instance_t* heaps_instance_create(const heaps_backend_t* backend)
+{
+	heaps_instance_t* inst = backend->alloc ? backend->alloc(backend->context, sizeof(heaps_instance_t)) : backend->realloc(backend->context, NULL, sizeof(heaps_instance_t));
+	if(inst)
+	{
+		*inst = (heaps_instance_t){.backend = *backend, .headroom = (size_t)-1};
+	#ifdef HEAPS_SAMPLING
+		inst->sample_random = SAMPLE_SEED;
+	#endif
+	};
+	return inst;
+}
+
+STATIC_IF_SANDBOXED bool heaps_instance_destroy(heaps_instance_t* inst)
+{
+	bool destroyed;
+#ifdef HEAPS_SLAB
+	void* chunk;
+#endif
+	INSTANCE_ENTER(inst);
+	destroyed = (get_count() == 0);
+#ifdef HEAPS_HASH_TABLE
+	if(destroyed && inst->table)
+		PLATFORM_FREE(inst->table);
+#endif
+#ifdef HEAPS_SLAB
+	while(destroyed && inst->slab_chunks)
+	{
+		chunk = inst->slab_chunks;
+		inst->slab_chunks = *(void**)chunk;
+		PLATFORM_FREE(chunk);
+	};
+#endif
+	INSTANCE_LEAVE();
+	if(destroyed)
+		inst->backend.free(inst->backend.context, inst);
+	return destroyed;
+}
+
+STATIC_IF_SANDBOXED heaps_instance_t* heaps_default_instance(void)
+{
+	return &default_instance;
+}
+
+#ifdef heaps_platform_alloc
+STATIC_IF_SANDBOXED void* heaps_instance_alloc_(heaps_instance_t* inst, size_t size, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(inst);
+	retval = alloc_(size, NULL, file, line);
+	INSTANCE_LEAVE();
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_realloc
+STATIC_IF_SANDBOXED void* heaps_instance_realloc_(heaps_instance_t* inst, void* ptr, size_t size, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(inst);
+	retval = realloc_(ptr, size, NULL, file, line);
+	INSTANCE_LEAVE();
+	return retval;
+}
+#endif
+
+#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
+STATIC_IF_SANDBOXED heaps_report_t* heaps_instance_report(heaps_instance_t* inst, int* arr_size)
+{
+	heaps_report_t* retval;
+	INSTANCE_ENTER(inst);
+	retval = report(arr_size);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_SAMPLING
+	sample_scale(retval, arr_size ? *arr_size : 0);
+#endif
+	return retval;
+}
+#endif
+
+STATIC_IF_SANDBOXED bool heaps_instance_report_into(heaps_instance_t* inst, heaps_report_t* buf, int capacity, int* arr_size)
+{
+	bool retval;
+	int size;
+	INSTANCE_ENTER(inst);
+	retval = report_into(buf, capacity, &size);
+	INSTANCE_LEAVE();
+#ifdef HEAPS_SAMPLING
+	sample_scale(buf, size);
+#endif
+	if(arr_size)
+		*arr_size = size;
+	return retval;
+}
+
+STATIC_IF_SANDBOXED void heaps_instance_report_foreach(heaps_instance_t* inst, heaps_report_callback_t callback, void* context)
+{
+	report_foreach(inst, callback, context);
+}
+
+#ifdef heaps_platform_free
+STATIC_IF_SANDBOXED void* heaps_instance_free_(heaps_instance_t* inst, void* ptr, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(inst);
+	retval = free_(ptr, file, line);
+	INSTANCE_LEAVE();
+	return retval;
+}
+#endif
+
+#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
+STATIC_IF_SANDBOXED void* heaps_instance_calloc_(heaps_instance_t* inst, size_t qty, size_t size, const char* file, int line)
+{
+	void* retval;
+	INSTANCE_ENTER(inst);
+	retval = calloc_(qty, size, NULL, file, line);
+	INSTANCE_LEAVE();
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_alloc
+STATIC_IF_SANDBOXED size_t heaps_instance_alloc_batch_(heaps_instance_t* inst, const size_t* sizes, size_t n, void** ptrs, const char* file, int line)
+{
+	size_t retval;
+	INSTANCE_ENTER(inst);
+	retval = alloc_batch(sizes, n, ptrs, NULL, file, line);
+	INSTANCE_LEAVE();
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_free
+STATIC_IF_SANDBOXED void heaps_instance_free_batch_(heaps_instance_t* inst, void** ptrs, size_t n, const char* file, int line)
+{
+	INSTANCE_ENTER(inst);
+	free_batch(ptrs, n, file, line);
+	INSTANCE_LEAVE();
+}
+#endif
+
+STATIC_IF_SANDBOXED int heaps_instance_get_allocation_count(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return get_count();
+}
+
+STATIC_IF_SANDBOXED int heaps_instance_get_allocation_count_peak(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return get_count_peak();
+}
+
+STATIC_IF_SANDBOXED size_t heaps_instance_get_headroom(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return get_headroom();
+}
+
+STATIC_IF_SANDBOXED heaps_report_t heaps_instance_get_largest_allocation(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return get_largest();
+}
+
+STATIC_IF_SANDBOXED heaps_stats_t heaps_instance_get_stats(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return get_stats();
+}
+
+STATIC_IF_SANDBOXED bool heaps_instance_check_step(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return check_step();
+}
+
+STATIC_IF_SANDBOXED heaps_t* heaps_instance_get_allocation_list(heaps_instance_t* inst)
+{
+	INSTANCE_SELECT(inst);
+	return allocation_list();
+}
+
+STATIC_IF_SANDBOXED heaps_t* heaps_instance_get_next_allocation(heaps_instance_t* inst, heaps_t* link)
+{
+	INSTANCE_SELECT(inst);
+	return next_allocation(link);
+}
+
+#endif
+
+//********************************************************************************************************
+// Private functions
+//********************************************************************************************************
+
+#ifdef HEAPS_ATOMIC_STATS
+
+static int get_count(void)
+{
+	return __atomic_load_n(&instance->allocation_count, __ATOMIC_RELAXED);
+}
+
+static int get_count_peak(void)
+{
+	return __atomic_load_n(&instance->allocation_count_peak, __ATOMIC_RELAXED);
+}
+
+static size_t get_headroom(void)
+{
+	return __atomic_load_n(&instance->headroom, __ATOMIC_RELAXED);
+}
+
+static heaps_report_t get_largest(void)
+{
+	heaps_report_t retval = {0};
+	unsigned seq;
+	do
+	{
+		seq = __atomic_load_n(&instance->largest_seq, __ATOMIC_ACQUIRE);
+		retval.size = __atomic_load_n(&instance->largest_allocation.size, __ATOMIC_RELAXED);
+		retval.file = __atomic_load_n(&instance->largest_allocation.file, __ATOMIC_RELAXED);
+		retval.line = __atomic_load_n(&instance->largest_allocation.line, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((seq & 1) || seq != __atomic_load_n(&instance->largest_seq, __ATOMIC_RELAXED));
+	return retval;
+}
+
+static heaps_stats_t get_stats(void)
+{
+	heaps_stats_t retval;
+	unsigned i;
+
+	retval.bytes = __atomic_load_n(&instance->stats.bytes, __ATOMIC_RELAXED);
+	retval.bytes_peak = __atomic_load_n(&instance->stats.bytes_peak, __ATOMIC_RELAXED);
+	retval.alloc_total = __atomic_load_n(&instance->stats.alloc_total, __ATOMIC_RELAXED);
+	retval.free_total = __atomic_load_n(&instance->stats.free_total, __ATOMIC_RELAXED);
+	for(i=0; i != HEAPS_STATS_BINS; i++)
+		retval.histogram[i] = __atomic_load_n(&instance->stats.histogram[i], __ATOMIC_RELAXED);
+	return retval;
+}
+
+#else
+
+static int get_count(void)
+{
+	return instance->allocation_count;
+}
+
+static int get_count_peak(void)
+{
+	return instance->allocation_count_peak;
+}
+
+static size_t get_headroom(void)
+{
+	return instance->headroom;
+}
+
+static heaps_report_t get_largest(void)
+{
+	return instance->largest_allocation;
+}
+
+static heaps_stats_t get_stats(void)
+{
+	return instance->stats;
+}
+
+#endif
+
+static size_t get_walk_passes(void)
+{
+	size_t passes = 0;
+	int i;
+	for(i=0; i != SHARD_COUNT; i++)
+		passes += instance->shards[i].walk_passes;
+	return passes;
+}
+
+static bool check_step(void)
+{
+	bool walk_intact;
+	bool platform_intact;
+	const char* file = __FILE__;
+	int line = __LINE__;
+	(void)file;(void)line;
+
+	PLATFORM_LOCK();
+#ifdef SHARDED
+	shard_enter(__atomic_fetch_add(&instance->shard_to_check, 1, __ATOMIC_RELAXED) % SHARD_COUNT);
+#endif
+	walk_intact = walk_check();
+	if(!walk_intact && shard->walk_last)
+	{
+		file = heaps_file_of(shard->walk_last);
+		line = heaps_line_of(shard->walk_last);
+	};
+#ifdef SHARDED
+	shard_leave();
+#endif
+	platform_intact = platform_check();
+	PLATFORM_UNLOCK();
+
+	if(!walk_intact || !platform_intact)
+		heaps_error_handler("heap broken", file, line);
+	return walk_intact && platform_intact;
+}
+
+#ifdef HEAPS_HASH_TABLE
+
+static heaps_t* allocation_list(void)
+{
+	return table_scan(0);
+}
+
+static heaps_t* next_allocation(heaps_t* link)
+{
+	size_t slot = table_find(link->content);
+	return (slot == instance->table_capacity) ? NULL : table_scan(slot+1);
+}
+
+#elif (defined HEAPS_SIDE_TABLE)
+
+static heaps_t* allocation_list(void)
+{
+	return side_scan(0);
+}
+
+static heaps_t* next_allocation(heaps_t* link)
+{
+	return side_scan(link - side_table + 1);
+}
+
+#elif (defined SHARDED)
+
+static heaps_t* allocation_list(void)
+{
+	return shard_scan(0);
+}
+
+static heaps_t* next_allocation(heaps_t* link)
+{
+	return NEXT_OF(link) ? NEXT_OF(link) : shard_scan(SHARD_OF(link)+1);
+}
+
+#else
+
+static heaps_t* allocation_list(void)
+{
+	return shard->head;
+}
+
+static heaps_t* next_allocation(heaps_t* link)
+{
+	return NEXT_OF(link);
+}
+
+#endif
+
+
+#ifdef heaps_platform_alloc
+static void* alloc_(size_t size, heaps_site_t* site, const char* file, int line)
+{
+	void* retval = NULL;
+	void* block;
+	size_t size_with_header = WITH_HEADER(size);
+
+#ifdef HEAPS_SAMPLING
+	if(!sample_pick(size))
+	{
+		if((retval = stub_alloc(size, "allocation failed", file, line)) != NULL)
+			track_linked(1, size, file, line);
+		return retval;
+	};
+#endif
+	check_heap(file, line);
+	block = BLOCK_ALLOC(size_with_header);
+	if(block == NULL)
+		heaps_error_handler("allocation failed", file, line);
+	else if((retval = link_allocation(block, size, site, file, line)) == NULL)
+	{
+		BLOCK_FREE(block, size_with_header);
+		heaps_error_handler("allocation tracking failed", file, line);
+	}
+	else
+		track_linked(1, size, file, line);
+
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_realloc
+static void* realloc_(void* ptr, size_t size, heaps_site_t* site, const char* file, int line)
+{
+	void* to_free;
+	void* to_realloc;
+	void* retval = NULL;
+	void* block;
+	size_t size_with_header = WITH_HEADER(size);
+	bool allocating = (ptr == NULL);
+#ifdef HEAPS_REALLOC_ZERO_DOESNT_FREE
+	bool reallocating = (ptr != NULL);
+	bool freeing = false;
+#else
+	bool reallocating = (ptr != NULL && size > 0);
+	bool freeing = (ptr != NULL && size == 0);
+#endif
+
+#ifdef HEAPS_SAMPLING
+	if(stub_realloc(&retval, ptr, size, file, line))
+		return retval;
+#endif
+	check_heap(file, line);
+	if(allocating)
+	{
+		block = BLOCK_REALLOC(NULL, 0, size_with_header);
+		if(block == NULL)
+			heaps_error_handler("allocation via heaps_realloc() failed", file, line);
+		else if((retval = link_allocation(block, size, site, file, line)) == NULL)
+		{
+			BLOCK_FREE(block, size_with_header);
+			heaps_error_handler("allocation tracking failed", file, line);
+		}
+		else
+			track_linked(1, size, file, line);
+	}
+	else if(freeing)
+	{
+		to_free = unlink_allocation(ptr, "false free via heaps_realloc()", file, line);
+		if(to_free != NULL)
+			retval = BLOCK_REALLOC(to_free, BLOCK_SIZE(to_free), 0);
+	}
+#ifdef HEAPS_PER_THREAD
+	// another thread's allocation can't be unlinked here, so it is copied to a new one, and queued for that thread to free
+	else if(reallocating && is_remote(ptr))
+	{
+		block = BLOCK_REALLOC(NULL, 0, size_with_header);
+		if(block == NULL)
+			heaps_error_handler("heaps_realloc() failed", file, line);
+		else if((retval = link_allocation(block, size, site, file, line)) == NULL)
+		{
+			BLOCK_FREE(block, size_with_header);
+			heaps_error_handler("allocation tracking failed", file, line);
+		}
+		else
+		{
+			memcpy(retval, ptr, (META_OF(ptr)->size < size) ? META_OF(ptr)->size : size);
+			remote_free(META_OF(ptr), "false free via heaps_realloc()", file, line);
+			track_linked(1, size, file, line);
+		};
+	}
+#endif
+	else if(reallocating)
+	{
+		to_realloc = unlink_allocation(ptr, NULL, file, line);
+		block = BLOCK_REALLOC(to_realloc, to_realloc ? BLOCK_SIZE(to_realloc) : 0, size_with_header);
+		if(block == NULL)
+			heaps_error_handler("heaps_realloc() failed", file, line);
+		else if((retval = link_allocation(block, size, site, file, line)) == NULL)
+		{
+			BLOCK_FREE(block, size_with_header);
+			heaps_error_handler("allocation tracking failed", file, line);
+		}
+		else
+			track_linked(1, size, file, line);
+	};
+
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_free
+static void* free_(void* ptr, const char* file, int line)
+{
+	void* to_free;
+#ifdef HEAPS_SAMPLING
+	if((to_free = stub_unlink(ptr)) != NULL)
+	{
+		BLOCK_FREE(to_free, STUB_BLOCK_SIZE(to_free));
+		return NULL;
+	};
+#endif
+	check_heap(file, line);
+	if(ptr)
+	{
+		to_free = unlink_allocation(ptr, "false free", file, line);
+		if(to_free != NULL)
+			BLOCK_FREE(to_free, BLOCK_SIZE(to_free));
+	};
+	return NULL;
+}
+#endif
+
+#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
+static void* calloc_(size_t qty, size_t size, heaps_site_t* site, const char* file, int line)
+{
+	void* retval = NULL;
+	void* block;
+	size_t size_with_header = WITH_HEADER(size * qty);
+
+	size *= qty;
+#ifdef HEAPS_SAMPLING
+	if(!sample_pick(size))
+	{
+		if((retval = stub_alloc(size, "calloc failed", file, line)) != NULL)
+		{
+			memset(retval, 0, size);
+			track_linked(1, size, file, line);
+		};
+		return retval;
+	};
+#endif
+	check_heap(file, line);
+	#ifdef heaps_platform_alloc
+		block = BLOCK_ALLOC(size_with_header);
+	#else
+		block = BLOCK_REALLOC(NULL, 0, size_with_header);
+	#endif
+	if(block == NULL)
+		heaps_error_handler("calloc failed", file, line);
+	else if((retval = link_allocation(block, size, site, file, line)) == NULL)
+	{
+		BLOCK_FREE(block, size_with_header);
+		heaps_error_handler("allocation tracking failed", file, line);
+	}
+	else
+	{
+		memset(retval, 0, size);
+		track_linked(1, size, file, line);
+	};
+	return retval;
+}
+#endif
+
+#ifdef heaps_platform_alloc
+static size_t alloc_batch(const size_t* sizes, size_t n, void** ptrs, heaps_site_t* site, const char* file, int line)
+{
+	size_t made = 0;
+	size_t largest = 0;
+	size_t i;
+	void* block;
+
+	check_heap(file, line);
+	while(made != n)
+	{
+	#ifdef HEAPS_SAMPLING
+		if(!sample_pick(sizes[made]))
+		{
+			if((ptrs[made] = stub_alloc(sizes[made], "allocation failed", file, line)) == NULL)
+				break;
+			if(sizes[made] > largest)
+				largest = sizes[made];
+			made++;
+			continue;
+		};
+	#endif
+		block = BLOCK_ALLOC(WITH_HEADER(sizes[made]));
+		if(block == NULL)
+		{
+			heaps_error_handler("allocation failed", file, line);
+			break;
+		}
+		else if((ptrs[made] = link_allocation(block, sizes[made], site, file, line)) == NULL)
+		{
+			BLOCK_FREE(block, WITH_HEADER(sizes[made]));
+			heaps_error_handler("allocation tracking failed", file, line);
+			break;
+		};
+		if(sizes[made] > largest)
+			largest = sizes[made];
+		made++;
+	};
+	if(made)
+		track_linked((int)made, largest, file, line);
+	for(i = made; i != n; i++)
+		ptrs[i] = NULL;
+	return made;
+}
+#endif
+
+#ifdef heaps_platform_free
+static void free_batch(void** ptrs, size_t n, const char* file, int line)
+{
+	void* to_free;
+	size_t i;
+
+	check_heap(file, line);
+	for(i = 0; i != n; i++)
+	{
+		if(ptrs[i])
+		{
+		#ifdef HEAPS_SAMPLING
+			if((to_free = stub_unlink(ptrs[i])) != NULL)
+			{
+				BLOCK_FREE(to_free, STUB_BLOCK_SIZE(to_free));
+				continue;
+			};
+		#endif
+			to_free = unlink_allocation(ptrs[i], "false free", file, line);
+			if(to_free != NULL)
+				BLOCK_FREE(to_free, BLOCK_SIZE(to_free));
+		};
+	};
+}
+#endif
+
+#ifdef heaps_platform_alloc
+static uint8_t* arena_chunk(heaps_arena_t* arena, size_t size, bool single)
+{
+	uint8_t* chunk;
+
+	INSTANCE_ENTER(&default_instance);
+	chunk = alloc_(size, NULL, arena->file, arena->line);
+	INSTANCE_LEAVE();
+
+	if(chunk == NULL)
+		return NULL;
+	if(single && arena->chunks)
+	{
+		*(uint8_t**)chunk = *(uint8_t**)arena->chunks;
+		*(uint8_t**)arena->chunks = chunk;
+	}
+	else
+	{
+		*(uint8_t**)chunk = arena->chunks;
+		arena->chunks = chunk;
+		if(!single)
+		{
+			arena->bump = chunk + ARENA_ALIGN;
+			arena->end = chunk + size;
+		};
+	};
+	return chunk + ARENA_ALIGN;
+}
+#endif
+
+static void check_heap(const char* file, int line)
+{
+	(void)file;(void)line;
+#if (WALK_CHECK)
+	if(!walk_check())
+		heaps_error_handler("heap broken", file, line);
+#endif
+#ifndef HEAPS_CHECKER_THREAD
+	if(!platform_check())
+		heaps_error_handler("heap broken", file, line);
+#endif
+}
+
+static bool platform_check(void)
+{
+#if (HEAPS_PLATFORM_CHECK_INTERVAL > 1)
+	if(instance->platform_check_countdown--)
+		return true;
+	instance->platform_check_countdown = HEAPS_PLATFORM_CHECK_INTERVAL-1;
+#endif
+	return PLATFORM_CHECK();
+}
+
+static bool walk_check(void)
+{
+	int budget = HEAPS_WALK_CHECK_BUDGET;
+	bool broken = false;
+	bool done = false;
+	heaps_t* link;
+
+	if(!shard->walk_in_pass)
+		walk_start();
+
+	while(!done && !broken && (HEAPS_WALK_CHECK_BUDGET == 0 || budget--))
+	{
+	#if (defined HEAPS_HASH_TABLE)
+		done = (shard->walk_slot == instance->table_capacity);
+		link = done ? NULL : (instance->table[shard->walk_slot] ? META_OF(instance->table[shard->walk_slot]) : NULL);
+		shard->walk_slot++;
+	#elif (defined HEAPS_SIDE_TABLE)
+		done = (shard->walk_slot == SIDE_ENTRIES);
+		link = (done || !SIDE_USED(&side_table[shard->walk_slot])) ? NULL : &side_table[shard->walk_slot];
+		shard->walk_slot++;
+	#else
+		done = (shard->walk_cursor == NULL);
+		link = shard->walk_cursor;
+	#endif
+		if(done)
+			broken = (shard->walk_visited < shard->walk_expected - shard->walk_unlinked*WALK_MISSED_PER_UNLINK);
+		else if(link)
+		{
+			// visiting more than there could be, means the list has become circular
+			broken = (++shard->walk_visited > shard->walk_expected + shard->walk_linked) || !SEALED(link);
+		#if (!defined LINKED_LIST)
+		#elif (defined HEAPS_COMPACT_HEADER)
+			broken = broken || !compact_reachable(NEXT_OF(link));
+		#else
+			broken = broken || ((uintptr_t)link->next % __alignof__(heaps_t));
+		#endif
+		#ifdef HEAPS_DOUBLY_LINKED
+			broken = broken || (link->next && link->next->prev != link);
+		#endif
+		#ifdef LINKED_LIST
+			shard->walk_cursor = NEXT_OF(link);
+		#endif
+			if(!broken)
+				shard->walk_last = link;
+		};
+	};
+
+	if(done && !broken)
+		shard->walk_passes++;
+	shard->walk_in_pass = !(done || broken);
+
+	return !broken;
+}
+
+static void walk_start(void)
+{
+	shard->walk_in_pass = true;
+#ifndef LINKED_LIST
+	shard->walk_slot = 0;
+#else
+	shard->walk_cursor = shard->head;
+#endif
+	shard->walk_last = NULL;
+	shard->walk_visited = 0;
+	shard->walk_expected = shard->count;
+	shard->walk_linked = 0;
+	shard->walk_unlinked = 0;
+}
+
+static void* link_allocation(void* block, size_t size, heaps_site_t* site, const char* file, int line)
+{
+	heaps_t* meta = META_OF_BLOCK(block);
+#ifdef HEAPS_SIDE_TABLE
+	if(!meta)
+		return NULL;
+#endif
+#ifdef HEAPS_COMPACT_HEADER
+	if(!compact_base)
+		compact_base = (uintptr_t)meta;
+	if(size > UINT32_MAX || !compact_reachable(meta))
+		return NULL;
+#endif
+#ifdef HEAPS_PER_THREAD
+	if(!own_shard && !thread_claim())
+		return NULL;
+#endif
+	SHARD_ENTER(block);
+#ifdef HEAPS_HASH_TABLE
+	if(!table_make_room())
+		return NULL;
+	table_insert(meta->content);
+#elif (defined LINKED_LIST)
+	if(!SEALED(shard->head))
+		heaps_error_handler("heap broken", file, line);
+#endif
+#ifdef HEAPS_SITE_COUNTERS
+	site = site ? site_register(site) : site_find(file, line);
+#else
+	(void)site;
+#endif
+	meta->size = size;
+#if (defined HEAPS_COMPACT_HEADER)
+	meta->site = site->index-1;
+#elif (defined HEAPS_STATIC_SITES)
+	meta->site = site;
+#else
+	meta->file = file;
+	meta->line = line;
+#endif
+#ifdef HEAPS_LIFETIMES
+	meta->born = lifetime_clock();
+#endif
+#ifdef LINKED_LIST
+	SET_NEXT(meta, shard->head);
+#endif
+#ifdef HEAPS_DOUBLY_LINKED
+	meta->prev = NULL;
+	meta->tag = TAG_OF(meta);
+#ifdef HEAPS_PER_THREAD
+	meta->owner = shard;
+	meta->remote_next = NULL;
+#endif
+	if(shard->head)
+		shard->head->prev = meta;
+	SEAL(shard->head);
+#endif
+#ifdef LINKED_LIST
+	shard->head = meta;
+#endif
+	SEAL(meta);
+	shard->count++;
+	shard->walk_linked++;
+	track_bytes(1, size);
+#ifdef HEAPS_SITE_COUNTERS
+	site_track(site, 1, size);
+#endif
+	SHARD_LEAVE();
+	return CONTENT_OF(meta);
+}
+
+#if (defined HEAPS_SIDE_TABLE)
+
+static void* unlink_allocation(void* ptr, const char* false_free_msg, const char* file, int line)
+{
+	heaps_t* meta = side_find(ptr);
+	void* to_free = NULL;
+	(void)file;(void)line;
+
+	if(meta == NULL)
+	{
+		if(false_free_msg)
+			heaps_error_handler(false_free_msg, file, line);
+	}
+	else if(!SEALED(meta))
+		heaps_error_handler("heap broken", file, line);
+	else
+	{
+		to_free = ptr;
+		if(shard->walk_last == meta)
+			shard->walk_last = NULL;
+		track_count(-1);
+		track_bytes(-1, meta->size);
+		shard->count--;
+		shard->walk_unlinked++;
+		unlink_site(meta);
+		*meta = (heaps_t){0};
+	};
+
+	return to_free;
+}
+
+static heaps_t* side_entry(void* block)
+{
+	uintptr_t offset = (uintptr_t)block - (uintptr_t)heaps_platform_base();
+	heaps_t* meta = NULL;
+
+	if(offset % HEAPS_SIDE_TABLE_GRANULE == 0 && offset / HEAPS_SIDE_TABLE_GRANULE < SIDE_ENTRIES)
+		meta = &side_table[offset / HEAPS_SIDE_TABLE_GRANULE];
+	if(meta && SIDE_USED(meta))
+		meta = NULL;
+	return meta;
+}
+
+static heaps_t* side_find(void* ptr)
+{
+	uintptr_t offset = (uintptr_t)ptr - (uintptr_t)heaps_platform_base();
+	heaps_t* meta = NULL;
+
+	if(offset % HEAPS_SIDE_TABLE_GRANULE == 0 && offset / HEAPS_SIDE_TABLE_GRANULE < SIDE_ENTRIES)
+		meta = &side_table[offset / HEAPS_SIDE_TABLE_GRANULE];
+	if(meta && !SIDE_USED(meta))
+		meta = NULL;
+	return meta;
+}
+
+static heaps_t* side_scan(size_t index)
+{
+	while(index < SIDE_ENTRIES && !SIDE_USED(&side_table[index]))
+		index++;
+	return (index < SIDE_ENTRIES) ? &side_table[index] : NULL;
+}
+
+#elif (defined HEAPS_HASH_TABLE)
+
+static void* unlink_allocation(void* ptr, const char* false_free_msg, const char* file, int line)
+{
+	size_t slot = table_find(ptr);
+	void* to_free = NULL;
+	(void)file;(void)line;
+
+	if(slot == instance->table_capacity)
+	{
+		if(false_free_msg)
+			heaps_error_handler(false_free_msg, file, line);
+	}
+	else if(!SEALED(META_OF(ptr)))
+		heaps_error_handler("heap broken", file, line);
+	else
+	{
+		table_remove(slot);
+		to_free = META_OF(ptr);
+		if(shard->walk_last == to_free)
+			shard->walk_last = NULL;
+		track_count(-1);
+		track_bytes(-1, ((heaps_t*)to_free)->size);
+		shard->count--;
+		shard->walk_unlinked++;
+		unlink_site(to_free);
+	};
+
+	return to_free;
+}
+
+static size_t table_hash(void* ptr)
+{
+	uintptr_t x = (uintptr_t)ptr / __alignof__(heaps_t);
+	x *= (uintptr_t)0x9E3779B97F4A7C15ULL;	// fibonacci hashing, the multiplier is truncated on 32bit platforms but remains odd
+	x ^= x >> (sizeof(uintptr_t)*4);
+	return x & (instance->table_capacity-1);
+}
+
+static size_t table_find(void* ptr)
+{
+	size_t slot = instance->table_capacity;
+
+	if(instance->table_capacity && ptr)
+	{
+		slot = table_hash(ptr);
+		while(instance->table[slot] && instance->table[slot] != ptr)
+			slot = (slot+1) & (instance->table_capacity-1);
+		if(!instance->table[slot])
+			slot = instance->table_capacity;
+	};
+	return slot;
+}
+
+static void table_insert(void* ptr)
+{
+	size_t slot = table_hash(ptr);
+	while(instance->table[slot])
+		slot = (slot+1) & (instance->table_capacity-1);
+	instance->table[slot] = ptr;
+}
+
+static void table_remove(size_t slot)
+{
+	size_t next = slot;
+	size_t home;
+	bool stays;
+
+	while(instance->table[next = (next+1) & (instance->table_capacity-1)])
+	{
+		// an entry can stay where it is, if it's home slot is cyclically within (slot, next]
+		home = table_hash(instance->table[next]);
+		if(slot <= next)
+			stays = (slot < home && home <= next);
+		else
+			stays = (slot < home || home <= next);
+		if(!stays)
+		{
+			instance->table[slot] = instance->table[next];
+			slot = next;
+		};
+	};
+	instance->table[slot] = NULL;
+}
+
+static bool table_make_room(void)
+{
+	bool retval = true;
+
+	if(instance->table_capacity == 0)
+		retval = table_resize(HEAPS_HASH_TABLE_MIN);
+	else if((size_t)(shard->count+1)*2 > instance->table_capacity)
+		retval = table_resize(instance->table_capacity*2) || ((size_t)(shard->count+1) < instance->table_capacity);	// carry on at a higher load if growing fails
+	else if((size_t)shard->count*8 < instance->table_capacity && instance->table_capacity > HEAPS_HASH_TABLE_MIN)
+		table_resize(instance->table_capacity/2);
+
+	return retval;
+}
+
+static bool table_resize(size_t new_capacity)
+{
+	void** old_table = instance->table;
+	size_t old_capacity = instance->table_capacity;
+	void** new_table = platform_alloc_untracked(new_capacity * sizeof(void*));
+
+	if(new_table)
+	{
+		memset(new_table, 0, new_capacity * sizeof(void*));
+		instance->table = new_table;
+		instance->table_capacity = new_capacity;
+		shard->walk_in_pass = false;	// the walk can't continue in a rehashed table, so it starts a new pass
+		while(old_capacity--)
+		{
+			if(old_table[old_capacity])
+				table_insert(old_table[old_capacity]);
+		};
+		if(old_table)
+			PLATFORM_FREE(old_table);
+	};
+	return (new_table != NULL);
+}
+
+static heaps_t* table_scan(size_t slot)
+{
+	while(slot < instance->table_capacity && !instance->table[slot])
+		slot++;
+	return (slot < instance->table_capacity) ? META_OF(instance->table[slot]) : NULL;
+}
+
+#elif (defined HEAPS_DOUBLY_LINKED)
+
+static void* unlink_allocation(void* ptr, const char* false_free_msg, const char* file, int line)
+{
+	heaps_t* meta = META_OF(ptr);
+	(void)file;(void)line;
+
+#ifdef HEAPS_PER_THREAD
+	if(is_remote(ptr))
+		return remote_free(meta, false_free_msg, file, line);
+	// a thread which has never allocated has no list, so anything else it frees is false
+	if(!own_shard)
+	{
+		if(false_free_msg)
+			heaps_error_handler(false_free_msg, file, line);
+		return NULL;
+	};
+#endif
+	SHARD_ENTER(meta);
+	if(!is_linked(ptr))
+	{
+		if(false_free_msg)
+			heaps_error_handler(false_free_msg, file, line);
+		meta = NULL;
+	}
+	else if(!SEALED(meta) || !SEALED(meta->prev) || !SEALED(meta->next))
+	{
+		heaps_error_handler("heap broken", file, line);
+		meta = NULL;
+	}
+	else
+	{
+		track_count(-1);
+		track_bytes(-1, meta->size);
+		unlink_linked(meta);
+	};
+	SHARD_LEAVE();
+
+	return meta;
+}
+
+static void unlink_linked(heaps_t* meta)
+{
+	if(meta->prev)
+		meta->prev->next = meta->next;
+	else
+		shard->head = meta->next;
+	if(meta->next)
+		meta->next->prev = meta->prev;
+	SEAL(meta->prev);
+	SEAL(meta->next);
+	meta->tag = 0;
+	if(shard->walk_cursor == meta)
+		shard->walk_cursor = meta->next;
+	if(shard->walk_last == meta)
+		shard->walk_last = NULL;
+	shard->count--;
+	shard->walk_unlinked++;
+	unlink_site(meta);
+}
+
+static bool is_linked(void* ptr)
+{
+	heaps_t* meta = META_OF(ptr);
+	bool retval = false;
+
+	if(ptr && !((uintptr_t)ptr % __alignof__(heaps_t)))
+	{
+		retval = (meta->tag == TAG_OF(meta));
+		if(retval)
+			retval = (meta->prev ? meta->prev->next == meta : shard->head == meta);
+		if(retval && meta->next)
+			retval = (meta->next->prev == meta);
+	#ifdef HEAPS_PER_THREAD
+		retval = retval && !meta->remote_next;
+	#endif
+	};
+	return retval;
+}
+
+#else
+
+static void* unlink_allocation(void* ptr, const char* false_free_msg, const char* file, int line)
+{
+	heaps_t *link;
+	heaps_t *prev = NULL;
+	heaps_t *to_free = NULL;
+	bool broken = false;
+	(void)file;(void)line;
+
+	SHARD_ENTER(META_OF(ptr));
+	link = shard->head;
+	// a heaps_t must be sealed before it's next member is followed
+	while(link && link->content != ptr && !(broken = !SEALED(link)))
+	{
+		prev = link;
+		link = NEXT_OF(link);
+	};
+	if(link && !broken)
+		broken = !SEALED(link) || !SEALED(NEXT_OF(link));
+
+	if(broken)
+		heaps_error_handler("heap broken", file, line);
+	else if(link == NULL)
+	{
+		if(false_free_msg)
+			heaps_error_handler(false_free_msg, file, line);
+	}
+	else
+	{
+		to_free = link;
+		if(prev)
+			SET_NEXT(prev, NEXT_OF(to_free));
+		else
+			shard->head = NEXT_OF(to_free);
+		SEAL(prev);
+		if(shard->walk_cursor == to_free)
+			shard->walk_cursor = NEXT_OF(to_free);
+		if(shard->walk_last == to_free)
+			shard->walk_last = NULL;
+		track_count(-1);
+		track_bytes(-1, ((heaps_t*)to_free)->size);
+		shard->count--;
+		shard->walk_unlinked++;
+		unlink_site(to_free);
+	};
+	SHARD_LEAVE();
+
+	return to_free;
+}
+
+#endif
+
+#ifdef HEAPS_SHARDS
+
+// fibonacci hashing of the address, as for the hash table
+static unsigned shard_index(void* block)
+{
+	uintptr_t x = (uintptr_t)block / __alignof__(heaps_t);
+	x *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+	x ^= x >> (sizeof(uintptr_t)*4);
+	return x % SHARD_COUNT;
+}
+
+#endif
+
+#ifdef SHARDED
+
+static void shard_enter(unsigned index)
+{
+	SHARD_LOCK(index);
+	shard = &instance->shards[index];
+#ifdef HEAPS_PER_THREAD
+	remote_drain();
+#endif
+}
+
+static void shard_leave(void)
+{
+	SHARD_UNLOCK((unsigned)(shard - instance->shards));
+	shard = NULL;
+}
+
+static heaps_t* shard_scan(unsigned index)
+{
+	heaps_t* link = NULL;
+	while(!link && index < SHARD_COUNT)
+		link = instance->shards[index++].head;
+	return link;
+}
+
+#endif
+
+#ifdef HEAPS_PER_THREAD
+
+static bool thread_claim(void)
+{
+	unsigned i;
+	for(i=0; !own_shard && i != SHARD_COUNT; i++)
+	{
+		if(!__atomic_test_and_set(&instance->shards[i].owned, __ATOMIC_ACQUIRE))
+			own_shard = &instance->shards[i];
+	};
+	if(own_shard)
+	{
+		pthread_once(&thread_key_once, thread_key_create);
+		pthread_setspecific(thread_key, own_shard);
+	};
+	return own_shard != NULL;
+}
+
+static void thread_key_create(void)
+{
+	pthread_key_create(&thread_key, thread_exit);
+}
+
+// the list is emptied of remote frees and given up, any allocations left in it are taken over with it by another thread
+static void thread_exit(void* state)
+{
+	shard_enter((unsigned)((shard_t*)state - instance->shards));
+	shard_leave();
+	own_shard = NULL;
+	__atomic_clear(&((shard_t*)state)->owned, __ATOMIC_RELEASE);
+}
+
+// the owner may be changing the links of it's neighbours, so only the tag and owner can be checked here
+static bool is_remote(void* ptr)
+{
+	heaps_t* meta = META_OF(ptr);
+	shard_t* owner;
+	bool retval = false;
+
+	if(ptr && !((uintptr_t)ptr % __alignof__(heaps_t)) && meta->tag == TAG_OF(meta))
+	{
+		owner = meta->owner;
+		retval = (owner >= instance->shards && owner < &instance->shards[SHARD_COUNT] && owner != own_shard);
+	};
+	return retval;
+}
+
+static void* remote_free(heaps_t* meta, const char* false_free_msg, const char* file, int line)
+{
+	shard_t* owner = meta->owner;
+	heaps_t* expected = NULL;
+	heaps_t* top;
+	(void)file;(void)line;
+
+	// claiming remote_next first means a second free of the same allocation is caught, even before the owner has unlinked it
+	if(!__atomic_compare_exchange_n(&meta->remote_next, &expected, meta, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+		if(false_free_msg)
+			heaps_error_handler(false_free_msg, file, line);
+	}
+	else
+	{
+		track_count(-1);
+		track_bytes(-1, meta->size);
+		top = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+		do
+			__atomic_store_n(&meta->remote_next, top ? top : meta, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&owner->remote, &top, meta, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	};
+	return NULL;
+}
+
+static void remote_drain(void)
+{
+	heaps_t* link = __atomic_exchange_n(&shard->remote, NULL, __ATOMIC_ACQUIRE);
+	heaps_t* next;
+
+	while(link)
+	{
+		next = (link->remote_next == link) ? NULL : link->remote_next;
+		link->remote_next = NULL;
+		if(!is_linked(link->content) || !SEALED(link) || !SEALED(link->prev) || !SEALED(link->next))
+			heaps_error_handler("heap broken", __FILE__, __LINE__);
+		else
+		{
+			unlink_linked(link);
+			BLOCK_FREE(link, BLOCK_SIZE(link));
+		};
+		link = next;
+	};
+}
+
+#endif
+
+#ifdef CLASSED
+
+static void* slab_alloc(size_t size)
+{
+	void* block;
+
+	if(size > HEAPS_SLAB_MAX)
+		block = PLATFORM_ALLOC_ANY(size);
+	else if((block = CACHE_POP(slab_class(size))) == NULL)
+		block = slab_take(slab_class(size));
+	return block;
+}
+
+#ifdef heaps_platform_realloc
+static void* slab_realloc(void* block, size_t old_size, size_t size)
+{
+	void* moved;
+
+	if(block == NULL)
+		moved = slab_alloc(size);
+	else if(size == 0)
+	{
+		slab_free(block, old_size);
+		moved = NULL;
+	}
+	else if(old_size > HEAPS_SLAB_MAX && size > HEAPS_SLAB_MAX)
+		moved = PLATFORM_REALLOC(block, size);
+	else if(old_size <= HEAPS_SLAB_MAX && size <= HEAPS_SLAB_MAX && slab_class(old_size) == slab_class(size))
+		moved = block;
+	else if((moved = slab_alloc(size)) != NULL)
+	{
+		memcpy(moved, block, (old_size < size) ? old_size : size);
+		slab_free(block, old_size);
+	};
+	return moved;
+}
+#endif
+
+static void slab_free(void* block, size_t size)
+{
+	if(size > HEAPS_SLAB_MAX)
+		PLATFORM_FREE(block);
+	else if(!CACHE_PUSH(block, slab_class(size)))
+		slab_release(block, slab_class(size));
+}
+
+// A block of n granules, where 2^b < n <= 2^(b+1), is in the class of 3*2^(b-1) granules if it fits, or 2^(b+1) if not
+static unsigned slab_class(size_t size)
+{
+	size_t n = (size + SLAB_GRANULE - 1) / SLAB_GRANULE;
+	unsigned b;
+
+	if(n <= 2)
+		return n ? n-1 : 0;
+	b = (sizeof(long)*8 - 1) - __builtin_clzl((unsigned long)(n-1));
+	return 2*b + (n > ((size_t)3 << (b-1)));
+}
+
+static size_t slab_size(unsigned class)
+{
+	unsigned b = class/2;
+	size_t n;
+
+	if(class < 2)
+		n = class+1;
+	else if(class & 1)
+		n = (size_t)2 << b;
+	else
+		n = (size_t)3 << (b-1);
+	return n * SLAB_GRANULE;
+}
+
+#ifdef HEAPS_SLAB
+
+static void* slab_take(unsigned class)
+{
+	slab_t* slab = &instance->slabs[class];
+	size_t block_size = slab_size(class);
+	void* block = slab->free;
+
+	if(block)
+		slab->free = *(void**)block;
+	else if((size_t)(slab->carve_end - slab->carve) >= block_size || slab_grow(slab))
+	{
+		block = slab->carve;
+		slab->carve += block_size;
+	};
+	return block;
+}
+
+static void slab_release(void* block, unsigned class)
+{
+	slab_t* slab = &instance->slabs[class];
+	*(void**)block = slab->free;
+	slab->free = block;
+}
+
+// The first granule of each chunk links it to the others, the rest of it is carved into blocks
+static bool slab_grow(slab_t* slab)
+{
+	uint8_t* chunk;
+
+	chunk = PLATFORM_ALLOC_ANY(HEAPS_SLAB_CHUNK);
+	if(chunk)
+	{
+		*(void**)chunk = instance->slab_chunks;
+		instance->slab_chunks = chunk;
+		slab->carve = chunk + SLAB_GRANULE;
+		slab->carve_end = chunk + HEAPS_SLAB_CHUNK;
+	};
+	return chunk != NULL;
+}
+
+#else
+
+// without HEAPS_SLAB, blocks of a class are rounded up to the class size, so that they can be reused for any allocation in it
+static void* slab_take(unsigned class)
+{
+	return PLATFORM_ALLOC_ANY(slab_size(class));
+}
+
+static void slab_release(void* block, unsigned class)
+{
+	(void)class;
+	PLATFORM_FREE(block);
+}
+
+#endif
+
+#endif
+
+#ifdef HEAPS_THREAD_CACHE
+
+static void* cache_pop(unsigned class)
+{
+	void* block = cache.head[class];
+
+	if(block)
+	{
+		cache.head[class] = *(void**)block;
+		cache.count[class]--;
+		cache.hits++;
+	}
+	else
+		cache.misses++;
+	if(cache.hits + cache.misses == CACHE_PUBLISH_INTERVAL)
+		cache_publish();
+	return block;
+}
+
+static bool cache_push(void* block, unsigned class)
+{
+	bool pushed = (cache.count[class] < HEAPS_THREAD_CACHE);
+
+	if(pushed)
+	{
+		if(!cache.registered)
+		{
+			pthread_once(&cache_key_once, cache_key_create);
+			pthread_setspecific(cache_key, &cache);
+			cache.registered = true;
+		};
+		*(void**)block = cache.head[class];
+		cache.head[class] = block;
+		cache.count[class]++;
+	};
+	return pushed;
+}
+
+static void cache_flush(void)
+{
+	unsigned class;
+	void* block;
+
+	for(class = 0; class != SLAB_CLASSES; class++)
+	{
+		while((block = cache.head[class]) != NULL)
+		{
+			cache.head[class] = *(void**)block;
+			slab_release(block, class);
+		};
+		cache.count[class] = 0;
+	};
+	cache_publish();
+}
+
+static void cache_publish(void)
+{
+	__atomic_add_fetch(&cache_hits, cache.hits, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&cache_misses, cache.misses, __ATOMIC_RELAXED);
+	cache.hits = 0;
+	cache.misses = 0;
+}
+
+static void cache_key_create(void)
+{
+	pthread_key_create(&cache_key, cache_exit);
+}
+
+// a block freed into the cache after this (by a destructor which runs later) registers it again, so it is flushed again
+static void cache_exit(void* state)
+{
+	(void)state;
+	cache.registered = false;
+	INSTANCE_ENTER(&default_instance);
+	cache_flush();
+	INSTANCE_LEAVE();
+}
+
+#endif
+
+#ifdef HEAPS_SAMPLING
+
+static bool sample_pick(size_t size)
+{
+	bool sampled = true;
+	if(sample_interval)
+	{
+		instance->sample_countdown -= (int64_t)size;
+		sampled = (instance->sample_countdown <= 0);
+		if(sampled)
+			instance->sample_countdown = sample_gap();
+	};
+	return sampled;
+}
+
+// -ln(u) * mean, for u uniform in (0,1], taking u from the top 26 bits of a 48bit LCG (that of drand48())
+static int64_t sample_gap(void)
+{
+	double u;
+	instance->sample_random = (instance->sample_random * 0x5DEECE66DULL + 0xB) & (((uint64_t)1 << 48) - 1);
+	u = (double)((instance->sample_random >> (48 - 26)) + 1);
+	return (int64_t)((26.0 - sample_log2(u)) * (0.6931471805599453 * (double)sample_interval)) + 1;
+}
+
+// Allocations of a site are assumed to be of it's average size. The count of sampled allocations is binomial,
+// so the variance of the estimated count is count * (1-p) / p^2, and the size's is that times the average size squared.
+static void sample_scale(heaps_report_t* arr, int arr_size)
+{
+	double average;
+	double chance;
+	double deviation;
+	double error;
+	int i;
+
+	for(i = 0; arr && i != arr_size; i++)
+	{
+		// a source location with nothing allocated now (from heaps_report_peaks()) has no average, and nothing to scale
+		if(!arr[i].count)
+		{
+			arr[i].count_error = 0;
+			arr[i].size_error = 0;
+			continue;
+		};
+		average = (double)arr[i].size / (double)arr[i].count;
+		chance = sample_chance(average);
+		deviation = sample_sqrt((double)arr[i].count * (1.0 - chance)) / chance;
+		error = 2.0 * deviation;		// rounded up, so that a rounded estimate of an almost certainly sampled site is still within it
+		arr[i].count_error = (int)error + ((int)error < error);
+		error *= average;
+		arr[i].size_error = (size_t)error + ((size_t)error < error);
+		arr[i].count = (int)((double)arr[i].count / chance + 0.5);
+		arr[i].size = (size_t)((double)arr[i].size / chance + 0.5);
+	};
+}
+
+// 1-exp(-x) loses it's precision for small x, where the start of it's series is used instead
+static double sample_chance(double size)
+{
+	double x = ((size < 1.0) ? 1.0 : size) / (double)(sample_interval ? sample_interval : 1);
+	if(sample_interval == 0)
+		return 1.0;
+	else if(x < 0.01)
+		return x * (1.0 - x/2 * (1.0 - x/3));
+	else
+		return 1.0 - sample_exp2(-x * SAMPLE_LOG2_E);
+}
+
+// the exponent is taken from the bits of x, and the log of the mantissa m from the series of 2*atanh((m-1)/(m+1))
+static double sample_log2(double x)
+{
+	uint64_t bits;
+	double m;
+	double s;
+	double s2;
+	int exponent;
+
+	memcpy(&bits, &x, sizeof(bits));
+	exponent = (int)((bits >> 52) & 0x7FF) - 1023;
+	bits = (bits & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1023 << 52);
+	memcpy(&m, &bits, sizeof(m));
+	s = (m - 1.0) / (m + 1.0);
+	s2 = s * s;
+	return exponent + 2.0 * SAMPLE_LOG2_E * s * (1.0 + s2 * (1.0/3 + s2 * (1.0/5 + s2 / 7)));
+}
+
+// 2^x = 2^k * 2^f, with f in [0,1) from it's Taylor series, and 2^k made from it's bits
+static double sample_exp2(double x)
+{
+	static const double series[] = {1.0, 0.6931471805599453, 0.2402265069591007, 0.05550410866482158, 0.009618129107628477, 0.0013333558146428443, 0.00015403530393381606};
+	double f;
+	double retval = 0.0;
+	double scale;
+	uint64_t bits;
+	int k;
+	int i;
+
+	if(x > -1022.0)
+	{
+		k = (int)x;
+		if(k > x)
+			k--;
+		f = x - k;
+		for(i = sizeof(series)/sizeof(series[0]); i--;)
+			retval = retval * f + series[i];
+		bits = (uint64_t)(k + 1023) << 52;
+		memcpy(&scale, &bits, sizeof(scale));
+		retval *= scale;
+	};
+	return retval;
+}
+
+// Newton's method, from a guess with half the exponent of x
+static double sample_sqrt(double x)
+{
+	double retval = x;
+	double last = 0.0;
+	uint64_t bits;
+
+	if(x > 0.0)
+	{
+		memcpy(&bits, &x, sizeof(bits));
+		bits = (bits >> 1) + ((uint64_t)1023 << 51);
+		memcpy(&retval, &bits, sizeof(retval));
+		while(retval != last)
+		{
+			last = retval;
+			retval = (retval + x / retval) / 2;
+		};
+	};
+	return retval;
+}
+
+static void* stub_alloc(size_t size, const char* fail_msg, const char* file, int line)
+{
+	stub_t* stub;
+	(void)fail_msg;(void)file;(void)line;
+#ifdef heaps_platform_alloc
+	stub = BLOCK_ALLOC(size + STUB_SIZE);
+#else
+	stub = BLOCK_REALLOC(NULL, 0, size + STUB_SIZE);
+#endif
+	if(stub == NULL)
+	{
+		heaps_error_handler(fail_msg, file, line);
+		return NULL;
+	};
+	stub->size = size;
+	stub->tag = STUB_TAG(stub);
+	instance->unsampled++;
+	track_bytes(1, size);
+	return stub->content;
+}
+
+static stub_t* stub_find(void* ptr)
+{
+	stub_t* stub = NULL;
+	if(ptr && instance->unsampled && !((uintptr_t)ptr % __alignof__(stub_t)))
+		stub = STUB_OF(ptr);
+	return (stub && stub->tag == STUB_TAG(stub)) ? stub : NULL;
+}
+
+static stub_t* stub_unlink(void* ptr)
+{
+	stub_t* stub = stub_find(ptr);
+	if(stub)
+	{
+		stub->tag = 0;
+		instance->unsampled--;
+		track_count(-1);
+		track_bytes(-1, stub->size);
+	};
+	return stub;
+}
+
+// the tag is cleared while the block is reallocated, so that it isn't left behind if it moves
+static bool stub_realloc(void** retval, void* ptr, size_t size, const char* file, int line)
+{
+	bool handled = true;
+	stub_t* stub;
+	void* block;
+
+	if(ptr == NULL)
+	{
+		handled = !sample_pick(size);
+		if(handled && (*retval = stub_alloc(size, "allocation via heaps_realloc() failed", file, line)) != NULL)
+			track_linked(1, size, file, line);
+	}
+	else if((stub = stub_find(ptr)) == NULL)
+		handled = false;
+#ifndef HEAPS_REALLOC_ZERO_DOESNT_FREE
+	else if(size == 0)
+	{
+		stub_unlink(ptr);
+		*retval = BLOCK_REALLOC(stub, STUB_BLOCK_SIZE(stub), 0);
+	}
+#endif
+	else
+	{
+		stub->tag = 0;
+		block = BLOCK_REALLOC(stub, STUB_BLOCK_SIZE(stub), size + STUB_SIZE);
+		if(block == NULL)
+		{
+			stub->tag = STUB_TAG(stub);
+			heaps_error_handler("heaps_realloc() failed", file, line);
+		}
+		else
+		{
+			stub = block;
+			track_bytes(-1, stub->size);
+			track_bytes(1, size);
+			stub->size = size;
+			stub->tag = STUB_TAG(stub);
+			*retval = stub->content;
+			track_largest(size, file, line);
+			track_headroom();
+		};
+	};
+	return handled;
+}
+
+#endif
+
+#ifdef HEAPS_COMPACT_HEADER
+
+static bool compact_reachable(heaps_t* meta)
+{
+	intptr_t offset = ((intptr_t)meta - (intptr_t)compact_base) / COMPACT_UNIT;
+	return !meta || (((uintptr_t)meta % COMPACT_UNIT) == 0 && -COMPACT_RANGE < offset && offset < COMPACT_RANGE);
+}
+
+#endif
+
+#ifdef HEAPS_HEADER_CHECKSUM
+
+static uint32_t checksum(heaps_t* meta)
+{
+	uint32_t sum = HEAPS_CHECK_MAGIC;
+	sum = checksum_word(sum, meta->size);
+#if (defined HEAPS_COMPACT_HEADER || defined HEAPS_STATIC_SITES)
+	sum = checksum_word(sum, (uintptr_t)meta->site);
+#else
+	sum = checksum_word(sum, (uintptr_t)meta->file);
+	sum = checksum_word(sum, (uintptr_t)meta->line);
+#endif
+#ifdef HEAPS_LIFETIMES
+	sum = checksum_word(sum, meta->born);
+#endif
+#ifdef LINKED_LIST
+	sum = checksum_word(sum, (uintptr_t)meta->next);
+#endif
+#ifdef HEAPS_DOUBLY_LINKED
+	sum = checksum_word(sum, (uintptr_t)meta->prev);
+	sum = checksum_word(sum, meta->tag);
+#endif
+	sum ^= sum >> 16;	// final avalanche, so that single bit errors change both halves
+	sum *= 0x85EBCA6B;
+	sum ^= sum >> 13;
+	return sum;
+}
+
+// fold the word to 32 bits, then one step of FNV-1a over the whole word
+static uint32_t checksum_word(uint32_t sum, uintptr_t word)
+{
+	word ^= (word >> 16) >> 16;
+	return (sum ^ (uint32_t)word) * 0x01000193;
+}
+
+#endif
+
+#ifdef HEAPS_CHECKER_THREAD
+
+static void* checker_main(void* arg)
+{
+	(void)arg;
+	struct timespec interval = {.tv_sec = checker_interval_us / 1000000, .tv_nsec = (checker_interval_us % 1000000) * 1000};
+
+	while(__atomic_load_n(&checker_running, __ATOMIC_ACQUIRE))
+	{
+		heaps_check_step();
+		nanosleep(&interval, NULL);
+	};
+	return NULL;
+}
+
+#endif
+
+#ifdef HEAPS_INSTANCES
+
+#ifdef heaps_platform_alloc
+static void* default_alloc(void* context, size_t size)
+{
+	(void)context;
+	return heaps_platform_alloc(size);
+}
+#endif
+
+#ifdef heaps_platform_realloc
+static void* default_realloc(void* context, void* ptr, size_t size)
+{
+	(void)context;
+	return heaps_platform_realloc(ptr, size);
+}
+#endif
+
+static void default_free(void* context, void* ptr)
+{
+	(void)context;
+	heaps_platform_free(ptr);
+}
+
+static bool default_check(void* context)
+{
+	(void)context;
+	return heaps_platform_check();
+}
+
+static size_t default_largest_free(void* context)
+{
+	(void)context;
+	return heaps_platform_largest_free();
+}
+
+static void default_lock(void* context)
+{
+	(void)context;
+	heaps_platform_lock();
+}
+
+static void default_unlock(void* context)
+{
+	(void)context;
+	heaps_platform_unlock();
+}
+
+#endif
+
+static void unlink_site(heaps_t* meta)
+{
+#if (defined HEAPS_COMPACT_HEADER)
+	heaps_site_t* site = sites[meta->site];
+#elif (defined HEAPS_STATIC_SITES)
+	heaps_site_t* site = meta->site;
+#elif (defined HEAPS_SITE_COUNTERS)
+	heaps_site_t* site = site_find(meta->file, meta->line);
 #endif
+#ifdef HEAPS_LIFETIMES
+	unsigned bin = lifetime_bin(meta);
+#endif
+#ifdef HEAPS_SITE_COUNTERS
+	site_track(site, -1, meta->size);
+#else
+	(void)meta;
+#endif
+#if (defined HEAPS_LIFETIMES && defined HEAPS_LOCK_FREE_REPORT)
+	__atomic_store_n(&site->lifetimes[bin], site->lifetimes[bin]+1, __ATOMIC_RELAXED);
+#elif (defined HEAPS_LIFETIMES)
+	site->lifetimes[bin]++;
+#endif
+}
 
-#ifdef heaps_platform_realloc
-static void* realloc_(void* ptr, size_t size, const char* file, int line)
+#if (defined HEAPS_SITE_COUNTERS || defined HEAPS_TRACE)
+
+static uint32_t location_hash(const char* file, int line)
 {
-	void* to_free;
-	void* to_realloc;
-	void* retval = NULL;
-	heaps_t* meta;
-	size_t size_with_meta = size + sizeof(heaps_t);
-	bool allocating = (ptr == NULL);
-#ifdef HEAPS_REALLOC_ZERO_DOESNT_FREE
-	bool reallocating = (ptr != NULL);
-	bool freeing = false;
-#else
-	bool reallocating = (ptr != NULL && size > 0);
-	bool freeing = (ptr != NULL && size == 0);
+	uint32_t hash = 0x811C9DC5;
+	while(*file)
+		hash = (hash ^ (uint8_t)*file++) * 0x01000193;
+	return (hash ^ (uint32_t)line) * 0x01000193;
+}
+
 #endif
 
-	check_heap(file, line);
-	if(allocating)
+#ifdef HEAPS_TRACE
+
+// Only this thread writes head, the acquire of tail keeps it from overwriting events which are still being drained
+static void trace(heaps_trace_op_t op, void* ptr, void* old, size_t size, const char* file, int line)
+{
+	trace_ring_t* ring = own_ring;
+	size_t head = 0;
+
+	if(!ring && trace_claim())
+		ring = own_ring;
+	if(ring)
+		head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	if(!ring || head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == HEAPS_TRACE_EVENTS)
+		__atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+	else
 	{
-		meta = heaps_platform_realloc(NULL, size_with_meta);
-		if(meta == NULL)
-			heaps_error_handler("allocation via heaps_realloc() failed", file, line);
-		else
-			retval = link_allocation(meta, size, file, line);			
-	}
-	else if(freeing)
+		ring->events[head & (HEAPS_TRACE_EVENTS-1)] = (heaps_trace_event_t)
+		{
+		#ifdef heaps_platform_time
+			.time = heaps_platform_time(),
+		#else
+			.time = __atomic_add_fetch(&trace_clock, 1, __ATOMIC_RELAXED),
+		#endif
+			.ptr = (uintptr_t)ptr,
+			.old = (uintptr_t)old,
+			.size = (size > UINT32_MAX) ? UINT32_MAX : (uint32_t)size,
+			.site = heaps_trace_site(file, line),
+			.op = (uint8_t)op,
+			.thread = (uint8_t)(ring - trace_rings),
+		};
+		__atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+	};
+}
+
+static bool trace_claim(void)
+{
+	unsigned i;
+	for(i=0; !own_ring && i != HEAPS_TRACE_THREADS; i++)
 	{
-		to_free = unlink_allocation(ptr);
-		if(to_free == NULL)
-			heaps_error_handler("false free via heaps_realloc()", file, line);
-		else
-			retval = heaps_platform_realloc(to_free, 0);
-	}
-	else if(reallocating)
+		if(!__atomic_test_and_set(&trace_rings[i].owned, __ATOMIC_ACQUIRE))
+			own_ring = &trace_rings[i];
+	};
+	if(own_ring)
 	{
-		to_realloc = unlink_allocation(ptr);
-		meta = heaps_platform_realloc(to_realloc, size_with_meta);
-		if(meta == NULL)
-			heaps_error_handler("heaps_realloc() failed", file, line);
-		else
-			retval = link_allocation(meta, size, file, line);
+		pthread_once(&trace_key_once, trace_key_create);
+		pthread_setspecific(trace_key, own_ring);
 	};
+	return own_ring != NULL;
+}
 
-	if(retval != NULL)
-		track_headroom();
+static void trace_key_create(void)
+{
+	pthread_key_create(&trace_key, trace_exit);
+}
 
-	return retval;
+// the events left in the ring are kept, for the drain or the next owner to carry on from
+static void trace_exit(void* ring)
+{
+	own_ring = NULL;
+	__atomic_clear(&((trace_ring_t*)ring)->owned, __ATOMIC_RELEASE);
 }
-#endif
 
-#ifdef heaps_platform_free
-static void* free_(void* ptr, const char* file, int line)
+static size_t trace_drain(heaps_trace_event_t* buf, size_t capacity)
 {
-	void* to_free;
-	check_heap(file, line);
-	if(ptr)
+	trace_ring_t* ring;
+	size_t count = 0;
+	size_t head;
+	size_t tail;
+
+	for(ring = trace_rings; ring != &trace_rings[HEAPS_TRACE_THREADS]; ring++)
 	{
-		to_free = unlink_allocation(ptr);
-		if(to_free == NULL)
-			heaps_error_handler("false free", file, line);
-		else
-			heaps_platform_free(to_free);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		while(tail != head && count != capacity)
+			buf[count++] = ring->events[tail++ & (HEAPS_TRACE_EVENTS-1)];
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
 	};
-	return NULL;
+	return count;
 }
+
 #endif
 
-#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
-static void* calloc_(size_t qty, size_t size, const char* file, int line)
+#ifdef HEAPS_LIFETIMES
+
+// alloc_total is counted as each allocation is linked, after it's birth is taken
+static uint32_t lifetime_clock(void)
 {
-	void* retval = NULL;
-	heaps_t* meta;
-	size_t size_with_meta = (size * qty) + sizeof(heaps_t);
+	return (uint32_t)__atomic_load_n(&instance->stats.alloc_total, __ATOMIC_RELAXED);
+}
 
-	check_heap(file, line);
-	size *= qty;
-	#ifdef heaps_platform_alloc
-		meta = heaps_platform_alloc(size_with_meta);
+static unsigned lifetime_bin(heaps_t* meta)
+{
+	unsigned bin = size_bin(lifetime_clock() - meta->born - 1);
+	return (bin < HEAPS_LIFETIME_BINS) ? bin : HEAPS_LIFETIME_BINS-1;
+}
+
+#endif
+
+#ifdef HEAPS_SITE_COUNTERS
+
+static heaps_site_t* site_find(const char* file, int line)
+{
+	size_t slot = site_hash(file, line);
+	heaps_site_t* site = NULL;
+
+	while(!site && site_slots[slot])
+	{
+		site = &site_pool[site_slots[slot]-1];
+		if(site->line != line || strcmp(site->file, file))
+		{
+			site = NULL;
+			slot = (slot+1) % SITE_SLOTS;
+		};
+	};
+
+	if(!site && site_count != HEAPS_MAX_SITES)
+	{
+		site = &site_pool[site_pool_count++];
+		*site = (heaps_site_t){.file = file, .line = line};
+		site_slots[slot] = site_pool_count;
+		site = site_register(site);
+	}
+	else if(!site)
+		site = &site_overflow;
+	return site;
+}
+
+// The pool can't fill before the table, as every site in the pool is also in the table
+static heaps_site_t* site_register(heaps_site_t* site)
+{
+	if(!site->index && site_count != HEAPS_MAX_SITES)
+	{
+		sites[site_count] = site;
+		site->index = site_count+1;
+	#ifdef HEAPS_LOCK_FREE_REPORT
+		__atomic_store_n(&site_count, site_count+1, __ATOMIC_RELEASE);	// publishes the entry
 	#else
-		meta = heaps_platform_realloc(NULL, size_with_meta);
+		site_count++;
 	#endif
-	if(meta == NULL)
-		heaps_error_handler("calloc failed", file, line);
-	else
+	}
+	else if(!site->index)
+		site = &site_overflow;
+	return site;
+}
+
+static size_t site_hash(const char* file, int line)
+{
+	return location_hash(file, line) % SITE_SLOTS;
+}
+
+#ifdef HEAPS_LOCK_FREE_REPORT
+
+// The lock keeps writers out of each other's way, so the sequence count only has to hold off readers
+static void site_track(heaps_site_t* site, int change, size_t size)
+{
+	unsigned seq = site->seq;
+	__atomic_store_n(&site->seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&site->count, site->count + change, __ATOMIC_RELAXED);
+	__atomic_store_n(&site->size, (change > 0) ? site->size + size : site->size - size, __ATOMIC_RELAXED);
+#ifdef HEAPS_SITE_PEAKS
+	if(change > 0)
 	{
-		retval = link_allocation(meta, size, file, line);
-		memset(retval, 0, size);
-		track_headroom();
+		__atomic_store_n(&site->total, site->total + change, __ATOMIC_RELAXED);
+		if(site->count > site->count_peak)
+			__atomic_store_n(&site->count_peak, site->count, __ATOMIC_RELAXED);
+		if(site->size > site->size_peak)
+			__atomic_store_n(&site->size_peak, site->size, __ATOMIC_RELAXED);
 	};
-	return retval;
+#endif
+	__atomic_store_n(&site->seq, seq+2, __ATOMIC_RELEASE);
 }
+
+static void site_read(heaps_site_t* site, heaps_report_t* entry)
+{
+	unsigned seq;
+#ifdef HEAPS_LIFETIMES
+	int i;
 #endif
+	*entry = (heaps_report_t){.file = site->file, .line = site->line};
+	do
+	{
+		seq = __atomic_load_n(&site->seq, __ATOMIC_ACQUIRE);
+		entry->count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+		entry->size = __atomic_load_n(&site->size, __ATOMIC_RELAXED);
+	#ifdef HEAPS_SITE_PEAKS
+		entry->count_peak = __atomic_load_n(&site->count_peak, __ATOMIC_RELAXED);
+		entry->size_peak = __atomic_load_n(&site->size_peak, __ATOMIC_RELAXED);
+		entry->total = __atomic_load_n(&site->total, __ATOMIC_RELAXED);
+	#endif
+	#ifdef HEAPS_LIFETIMES
+		for(i=0; i != HEAPS_LIFETIME_BINS; i++)
+			entry->lifetimes[i] = __atomic_load_n(&site->lifetimes[i], __ATOMIC_RELAXED);
+	#endif
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((seq & 1) || seq != __atomic_load_n(&site->seq, __ATOMIC_RELAXED));
+}
 
-static void check_heap(const char* file, int line)
+// A site's file and line never change once it is in the table, and it is published by site_count
+static bool report_snapshot(heaps_report_t* buf, int capacity, int* arr_size)
 {
-#ifndef HEAPS_NO_PRE_OPERATION_WALK_CHECK
-	heaps_t *link = head;
-	int count = 0;
-	while(link)
+	int published = __atomic_load_n(&site_count, __ATOMIC_ACQUIRE);
+	int size = 0;
+	bool full = false;
+	heaps_report_t entry;
+	int i;
+
+	for(i = 0; i <= published; i++)
 	{
-		count++;
-		link = link->next;
+		site_read((i == published) ? &site_overflow : sites[i], &entry);
+		if(entry.count && size == capacity)
+			full = true;
+		else if(entry.count)
+			buf[size++] = entry;
 	};
-	if(count != allocation_count)
-		heaps_error_handler("heap broken", file, line);
-#endif
-	if(!heaps_platform_check())
-		heaps_error_handler("heap broken", file, line);
+	if(arr_size)
+		*arr_size = size;
+	return !full;
 }
 
-static void* link_allocation(heaps_t* meta, size_t size, const char* file, int line)
+#else
+
+static void site_track(heaps_site_t* site, int change, size_t size)
 {
-	meta->size = size;
-	meta->file = file;
-	meta->line = line;
-	meta->next = head;
-	head = meta;
-	allocation_count++;
-	if(allocation_count > allocation_count_peak)
-		allocation_count_peak = allocation_count;
-  	if(size > largest_allocation.size)
+	site->count += change;
+	if(change > 0)
+		site->size += size;
+	else
+		site->size -= size;
+#ifdef HEAPS_SITE_PEAKS
+	if(change > 0)
 	{
-		largest_allocation.size = size;
-		largest_allocation.file = file;
-		largest_allocation.line = line;
+		site->total += change;
+		if(site->count > site->count_peak)
+			site->count_peak = site->count;
+		if(site->size > site->size_peak)
+			site->size_peak = site->size;
 	};
-	return meta->content;
+#endif
+}
+
+#endif
+
+#endif
+
+#ifdef HEAPS_ATOMIC_STATS
+
+static void track_headroom(void)
+{
+	size_t largest_free = PLATFORM_LARGEST_FREE();
+	size_t old = __atomic_load_n(&instance->headroom, __ATOMIC_RELAXED);
+	while(largest_free < old && !__atomic_compare_exchange_n(&instance->headroom, &old, largest_free, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 }
 
-static void* unlink_allocation(void* ptr)
+static void track_count(int change)
 {
-	heaps_t **link = &head;
-	void* to_free;
+	int count = __atomic_add_fetch(&instance->allocation_count, change, __ATOMIC_RELAXED);
+	int old = __atomic_load_n(&instance->allocation_count_peak, __ATOMIC_RELAXED);
+	while(count > old && !__atomic_compare_exchange_n(&instance->allocation_count_peak, &old, count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
-	while(*link && (*link)->content != ptr)
-		link = &(*link)->next;
+static void track_bytes(int change, size_t size)
+{
+	size_t bytes;
+	size_t old;
 
-	to_free = *link;
-	if(to_free != NULL)
+	if(change > 0)
+	{
+		bytes = __atomic_add_fetch(&instance->stats.bytes, size, __ATOMIC_RELAXED);
+		old = __atomic_load_n(&instance->stats.bytes_peak, __ATOMIC_RELAXED);
+		while(bytes > old && !__atomic_compare_exchange_n(&instance->stats.bytes_peak, &old, bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		__atomic_add_fetch(&instance->stats.alloc_total, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&instance->stats.histogram[size_bin(size)], 1, __ATOMIC_RELAXED);
+	}
+	else
 	{
-		*link = (*link)->next;
-		allocation_count--;
+		__atomic_sub_fetch(&instance->stats.bytes, size, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&instance->stats.free_total, 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&instance->stats.histogram[size_bin(size)], 1, __ATOMIC_RELAXED);
 	};
+}
 
-	return to_free;
+// The size is claimed first, so that only a larger allocation can follow. Then the record is rewritten inside
+// the sequence count (odd while writing), which also keeps writers of the record out of each other's way.
+static void track_largest(size_t size, const char* file, int line)
+{
+	size_t old = __atomic_load_n(&instance->largest_allocation.size, __ATOMIC_RELAXED);
+	unsigned seq;
+
+	while(size > old && !__atomic_compare_exchange_n(&instance->largest_allocation.size, &old, size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	if(size > old)
+	{
+		do
+			seq = __atomic_load_n(&instance->largest_seq, __ATOMIC_RELAXED) & ~1u;
+		while(!__atomic_compare_exchange_n(&instance->largest_seq, &seq, seq+1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+		if(size == __atomic_load_n(&instance->largest_allocation.size, __ATOMIC_RELAXED))	// unless a larger one has overtaken this
+		{
+			__atomic_store_n(&instance->largest_allocation.file, file, __ATOMIC_RELAXED);
+			__atomic_store_n(&instance->largest_allocation.line, line, __ATOMIC_RELAXED);
+		};
+		__atomic_store_n(&instance->largest_seq, seq+2, __ATOMIC_RELEASE);
+	};
 }
 
+#else
+
 static void track_headroom(void)
 {
-	size_t largest_free = heaps_platform_largest_free();
-	if(largest_free < headroom)
-		headroom = largest_free;
+	size_t largest_free = PLATFORM_LARGEST_FREE();
+	if(largest_free < instance->headroom)
+		instance->headroom = largest_free;
 }
 
-#ifdef heaps_platform_realloc
+static void track_count(int change)
+{
+	instance->allocation_count += change;
+	if(instance->allocation_count > instance->allocation_count_peak)
+		instance->allocation_count_peak = instance->allocation_count;
+}
+
+static void track_bytes(int change, size_t size)
+{
+	if(change > 0)
+	{
+		instance->stats.bytes += size;
+		if(instance->stats.bytes > instance->stats.bytes_peak)
+			instance->stats.bytes_peak = instance->stats.bytes;
+		instance->stats.alloc_total++;
+		instance->stats.histogram[size_bin(size)]++;
+	}
+	else
+	{
+		instance->stats.bytes -= size;
+		instance->stats.free_total++;
+		instance->stats.histogram[size_bin(size)]--;
+	};
+}
+
+static void track_largest(size_t size, const char* file, int line)
+{
+  	if(size > instance->largest_allocation.size)
+	{
+		instance->largest_allocation.size = size;
+		instance->largest_allocation.file = file;
+		instance->largest_allocation.line = line;
+	};
+}
+
+#endif
 
+static void track_linked(int count, size_t largest, const char* file, int line)
+{
+	track_count(count);
+	track_largest(largest, file, line);
+	track_headroom();
+}
+
+static unsigned size_bin(size_t size)
+{
+	return size ? (unsigned)(sizeof(long)*8 - __builtin_clzl((unsigned long)size)) : 0;
+}
+
+#if (defined heaps_platform_alloc || defined heaps_platform_realloc)
+
+// The report is allocated before it is gathered, if the source locations don't fit it is freed and tried again with twice the room.
+// As the report is the newest allocation it's own entry is added last, after those of the allocations which were there before it.
+// With HEAPS_SITE_COUNTERS it is already counted by it's site.
+// With HEAPS_SAMPLING the report is always sampled, so that it has a heaps_t, and the countdown is put back afterwards
+// so that the report doesn't change which of the application's allocations are sampled.
 static heaps_report_t* report(int* arr_size)
 {
 	heaps_report_t* arr = NULL;
+	report_t r;
+	int capacity = 2;
 	int size = 0;
-	heaps_t* link = head;
+	bool full = true;
+#ifdef HEAPS_SAMPLING
+	int64_t countdown;
+#endif
+
+	while(full && REPORT_LINKED)
+	{
+	#ifdef HEAPS_SAMPLING
+		countdown = instance->sample_countdown;
+		instance->sample_countdown = 0;
+		arr = REPORT_ALLOC(capacity * sizeof(heaps_report_t));
+		instance->sample_countdown = countdown;
+	#else
+		arr = REPORT_ALLOC(capacity * sizeof(heaps_report_t));
+	#endif
+		if(arr)
+		{
+		#if (defined HEAPS_SITE_COUNTERS)
+			r = (report_t){.buf = arr, .capacity = capacity};
+			report_visit(&r);
+			report_arenas(&r);
+		#else
+			r = (report_t){.buf = arr, .capacity = capacity-1, .own = META_OF(arr)};
+			report_visit(&r);
+			report_arenas(&r);
+			if(!r.full)
+				arr[r.size++] = (heaps_report_t){.file = r.own->file, .line = r.own->line, .count = 1, .size = r.own->size};
+		#endif
+			size = r.size;
+		};
+		full = (arr && r.full);
+		if(full)
+		{
+			arr = REPORT_FREE(arr);
+			capacity *= 2;
+		};
+	};
+
+	if(!arr)
+		size = 0;
+	if(arr_size)
+		*arr_size = size;
+	return arr;
+}
+
+#endif
+
+static bool report_into(heaps_report_t* buf, int capacity, int* arr_size)
+{
+	report_t r = {.buf = buf, .capacity = capacity};
+	report_visit(&r);
+	report_arenas(&r);
+	if(arr_size)
+		*arr_size = r.size;
+	return !r.full;
+}
+
+#ifdef HEAPS_SITE_PEAKS
+static bool report_peaks(heaps_report_t* buf, int capacity, int* arr_size)
+{
+	report_t r = {.buf = buf, .capacity = capacity, .idle = true};
+	report_visit(&r);
+	report_arenas(&r);
+	if(arr_size)
+		*arr_size = r.size;
+	return !r.full;
+}
+#endif
+
+// Each pass takes the HEAPS_REPORT_PASS source locations which come first (by file then line) after those of the previous pass.
+// The callback is made with the lock released, so it may use heaps, and the instance is selected again for the next pass.
+static void report_foreach(heaps_instance_t* inst, heaps_report_callback_t callback, void* context)
+{
+	heaps_report_t pass[HEAPS_REPORT_PASS];
+	report_t r = {.buf = pass, .capacity = HEAPS_REPORT_PASS, .full = true, .selecting = true};
 	int i;
-	bool found = false;
-	bool failed = false;	// allows us to fail gracefully without leaking memory if realloc fails for the report and no error handler is provided
+	(void)inst;
 
-	while(link && !failed)
+	while(r.full)
 	{
-		i = size;
-		found = false;
-		while(!found && i--)
-			found = (!strcmp(arr[i].file, link->file) && (arr[i].line == link->line));
+		r.size = 0;
+		r.full = false;
+		INSTANCE_ENTER(inst);
+		report_visit(&r);
+		report_arenas(&r);
+		INSTANCE_LEAVE();
+		report_sort(pass, r.size);
+		if(r.size)
+			r.after = pass[r.size-1];
+	#ifdef HEAPS_SAMPLING
+		sample_scale(pass, r.size);
+	#endif
+		for(i = 0; i != r.size; i++)
+			callback(&pass[i], context);
+	};
+}
 
-		if(found)
+#if (defined HEAPS_SITE_COUNTERS)
+
+// The sites are already counted, so are only copied (the overflow site is the one after the last)
+static void report_visit(report_t* r)
+{
+	heaps_site_t* site;
+	heaps_report_t entry;
+	int i;
+	for(i=0; i <= site_count; i++)
+	{
+		site = (i == site_count) ? &site_overflow : sites[i];
+	#ifdef HEAPS_SITE_PEAKS
+		if(site->count || (r->idle && site->total))
+	#else
+		if(site->count)
+	#endif
 		{
-			arr[i].count++;
-			arr[i].size += link->size;
-		}
-		else
-			failed = add_to_report(&arr, &size, link);
+			entry = (heaps_report_t){.file = site->file, .line = site->line, .count = site->count, .size = site->size,
+			#ifdef HEAPS_SITE_PEAKS
+				.count_peak = site->count_peak, .size_peak = site->size_peak, .total = site->total,
+			#endif
+			};
+		#ifdef HEAPS_LIFETIMES
+			memcpy(entry.lifetimes, site->lifetimes, sizeof(entry.lifetimes));
+		#endif
+			report_add(r, entry);
+		};
+	};
+}
 
-		link = link->next;
+#elif (defined SHARDED)
+
+// The shards are locked one at a time while they are visited
+static void report_visit(report_t* r)
+{
+	unsigned index;
+	heaps_t* link;
+
+	for(index = 0; index != SHARD_COUNT; index++)
+	{
+		shard_enter(index);
+		for(link = shard->head; link; link = link->next)
+		{
+			if(link != r->own)
+				report_add(r, (heaps_report_t){.file = link->file, .line = link->line, .count = 1, .size = link->size});
+		};
+		shard_leave();
 	};
+}
+
+#elif (defined HEAPS_HASH_TABLE)
+
+static void report_visit(report_t* r)
+{
+	size_t slot;
+	heaps_t* link;
 
-	// add the reports allocation (which must be at the head) to the report.
-	// the array is already oversized by 1 to allow for this 
-	if(size & !failed)
+	for(slot = 0; slot != instance->table_capacity; slot++)
 	{
-		arr[size].count = 1;
-		arr[size].size = head->size;
-		arr[size].file = head->file;
-		arr[size].line = head->line;
-		size++;
+		if(instance->table[slot])
+		{
+			link = META_OF(instance->table[slot]);
+			if(link != r->own)
+				report_add(r, (heaps_report_t){.file = link->file, .line = link->line, .count = 1, .size = link->size});
+		};
+	};
+}
+
+#else
+
+static void report_visit(report_t* r)
+{
+	heaps_t* link;
+	for(link = shard->head; link; link = link->next)
+	{
+		if(link != r->own)
+			report_add(r, (heaps_report_t){.file = link->file, .line = link->line, .count = 1, .size = link->size});
 	};
-	
-	if(arr_size)
-		*arr_size = size;
-	return arr;
 }
 
-static bool add_to_report(heaps_report_t** dst, int* dst_size, heaps_t* src)
+#endif
+
+// When selecting, the entries are the first source locations after r->after. Once the buffer is full, a source location is only
+// taken in place of the last entry, so the last only moves back, and one which is passed over never comes back in the same pass.
+static void report_add(report_t* r, heaps_report_t entry)
 {
-	heaps_report_t* arr = *dst;
-	heaps_report_t* new_arr;
-	int i = *dst_size;
-	bool failed;
-	(*dst_size)++;
+	int i = r->size;
+	int last = 0;
+	bool found = false;
 
-	new_arr = realloc_(arr, ((*dst_size)+1) * sizeof(heaps_report_t), __FILE__, __LINE__);	// maintain array oversized by one, so we can add the head at the end
-	failed = (new_arr == NULL);
-	if(failed)
+#ifndef HEAPS_SITE_COUNTERS
+	while(!found && i--)
+		found = (r->buf[i].line == entry.line && !strcmp(r->buf[i].file, entry.file));
+#endif
+	if(found)
 	{
-		arr = free_(arr, __FILE__, __LINE__);
-		*dst_size = 0;
+		r->buf[i].count += entry.count;
+		r->buf[i].size += entry.size;
 	}
+	else if(r->selecting && r->after.file && report_order(entry.file, entry.line, &r->after) <= 0)
+		;	// taken by an earlier pass
+	else if(r->size != r->capacity)
+		r->buf[r->size++] = entry;
 	else
 	{
-		arr = new_arr;
-		arr[i].count = 1;
-		arr[i].size = src->size;
-		arr[i].file = src->file;
-		arr[i].line = src->line;
-	}
-	*dst = arr;
-	return failed;
+		r->full = true;
+		for(i = 1; r->selecting && i != r->size; i++)
+		{
+			if(report_order(r->buf[i].file, r->buf[i].line, &r->buf[last]) > 0)
+				last = i;
+		};
+		if(r->selecting && report_order(entry.file, entry.line, &r->buf[last]) < 0)
+			r->buf[last] = entry;
+	};
 }
 
-#endif
+// An arena which has no entry (with HEAPS_SAMPLING, if none of it's allocations were sampled) is added as one with no allocations of it's own
+static void report_arenas(report_t* r)
+{
+	heaps_arena_t* arena;
+	int count;
+	size_t size;
+	int i;
+
+	ARENAS_LOCK();
+	for(arena = instance->arenas; arena; arena = arena->next)
+	{
+		count = __atomic_load_n(&arena->count, __ATOMIC_RELAXED);
+		size = __atomic_load_n(&arena->size, __ATOMIC_RELAXED);
+		for(i = 0; i != r->size && (r->buf[i].line != arena->line || strcmp(r->buf[i].file, arena->file)); i++);
+		if(i != r->size)
+		{
+			r->buf[i].arena_count += count;
+			r->buf[i].arena_size += size;
+		}
+		else
+			report_add(r, (heaps_report_t){.file = arena->file, .line = arena->line, .arena_count = count, .arena_size = size});
+	};
+	ARENAS_UNLOCK();
+}
+
+static int report_order(const char* file, int line, const heaps_report_t* entry)
+{
+	int retval = strcmp(file, entry->file);
+	if(retval == 0)
+		retval = (line > entry->line) - (line < entry->line);
+	return retval;
+}
+
+// insertion sort, there are only HEAPS_REPORT_PASS entries
+static void report_sort(heaps_report_t* arr, int arr_size)
+{
+	heaps_report_t entry;
+	int i;
+	int j;
+
+	for(i = 1; i < arr_size; i++)
+	{
+		entry = arr[i];
+		for(j = i; j && report_order(entry.file, entry.line, &arr[j-1]) < 0; j--)
+			arr[j] = arr[j-1];
+		arr[j] = entry;
+	};
+}
 #endif
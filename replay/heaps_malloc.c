@@ -0,0 +1,35 @@
+// *************************************
+//  heaps.h configured as: doubly linked list, on malloc
+
+    #include <stdlib.h>
+    #include "replay.h"
+
+    #define HEAPS_SANDBOX
+    #define HEAPS_NO_PRE_OPERATION_WALK_CHECK
+    #define HEAPS_DOUBLY_LINKED
+
+    #define heaps_error_handler(msg,file,line)  replay_error_handler(msg,file,line)
+
+    #define heaps_platform_free(ptr)            free(ptr)
+    #define heaps_platform_alloc(size)          malloc(size)
+    #define heaps_platform_realloc(ptr, size)   realloc(ptr, size)
+
+    #define HEAPS_IMPLEMENTATION
+    #include "../heaps.h"
+
+static void* replay_alloc(size_t size)
+{
+    return heaps_alloc(size);
+}
+
+static void* replay_realloc(void* ptr, size_t size)
+{
+    return heaps_realloc(ptr, size);
+}
+
+static void replay_free(void* ptr)
+{
+    heaps_free(ptr);
+}
+
+const replay_backend_t replay_heaps_malloc = {"heaps-malloc", replay_alloc, replay_realloc, replay_free, replay_malloc_footprint, NULL};
@@ -0,0 +1,36 @@
+// *************************************
+//  heaps.h configured as: doubly linked list, on mcheap
+
+    #include "mcheap.h"
+    #include "replay.h"
+
+    #define HEAPS_SANDBOX
+    #define HEAPS_NO_PRE_OPERATION_WALK_CHECK
+    #define HEAPS_DOUBLY_LINKED
+
+    #define heaps_error_handler(msg,file,line)  replay_error_handler(msg,file,line)
+
+    #define heaps_platform_free(ptr)            mcheap_free(ptr)
+    #define heaps_platform_alloc(size)          mcheap_allocate(size)
+    #define heaps_platform_realloc(ptr, size)   mcheap_reallocate(ptr, size)
+    #define heaps_platform_largest_free()       mcheap_largest_free()
+
+    #define HEAPS_IMPLEMENTATION
+    #include "../heaps.h"
+
+static void* replay_alloc(size_t size)
+{
+    return heaps_alloc(size);
+}
+
+static void* replay_realloc(void* ptr, size_t size)
+{
+    return heaps_realloc(ptr, size);
+}
+
+static void replay_free(void* ptr)
+{
+    heaps_free(ptr);
+}
+
+const replay_backend_t replay_heaps_mcheap = {"heaps-mcheap", replay_alloc, replay_realloc, replay_free, replay_mcheap_footprint, replay_mcheap_fragmentation};
@@ -0,0 +1,452 @@
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stdint.h>
+    #include <stdbool.h>
+    #include <string.h>
+    #include <time.h>
+    #include <malloc.h>
+
+    #include "mcheap.h"
+    #include "replay.h"
+
+//********************************************************************************************************
+// Local defines
+//********************************************************************************************************
+
+//  One operation of a trace.
+//  The id names an allocation, it's given by the alloc, and may be reused by a later alloc once it has been freed.
+    typedef struct op_t
+    {
+        char op;        // 'a' alloc, 'r' realloc, 'f' free
+        unsigned id;    // index in live[]
+        size_t size;    // unused for 'f'
+    } op_t;
+
+//  A trace id, and it's index in live[]. The ids of a trace are mapped to indexes as they are seen, so they may be any
+//  number and live[] only needs room for the ids which are used.
+    typedef struct id_slot_t
+    {
+        unsigned long id;
+        unsigned index;     // plus one, 0 if the slot is empty
+        bool live;          // while loading, if the id's allocation hasn't been freed
+    } id_slot_t;
+
+    #define PERCENTILES 5
+
+//  The results of replaying a trace on one backend
+    typedef struct result_t
+    {
+        double ops_per_sec;
+        double latency[PERCENTILES];    // ns
+        size_t failures;                // allocs and reallocs which returned NULL
+        size_t errors;                  // errors reported by heaps.h
+        size_t peak_requested;          // peak of the live bytes requested by the trace
+        size_t peak_footprint;          // peak bytes taken from the underlying heap
+        double fragmentation;           // worst fragmentation of the underlying heap
+    } result_t;
+
+//********************************************************************************************************
+// Private prototypes
+//********************************************************************************************************
+
+//  mcheap_free() returns a pointer, this adapts it for replay_backend_t
+    static void mcheap_free_void(void* ptr);
+
+//  Read the trace at path into ops[] and size live[] for the number of ids it uses.
+//  Return false with a message printed to stderr if the file can't be read, a line can't be parsed,
+//  or an id is allocated while it's previous allocation is still live.
+    static bool load(const char* path);
+
+//  Find the slot of a trace id, giving it the next index in live[] if it hasn't been seen before
+    static id_slot_t* find_id(unsigned long id);
+    static id_slot_t* probe_id(unsigned long id);
+
+//  Replay the trace on the backend three times, once untimed to measure footprint, once to measure throughput,
+//  and once timing each op for the latency percentiles.
+    static void replay(const replay_backend_t* backend, result_t* result);
+
+//  Apply one op, and return false if an alloc or realloc failed
+    static bool apply(const replay_backend_t* backend, const op_t* op);
+
+//  Free any allocations the trace leaves live, so the next pass starts with an empty heap
+    static void release(const replay_backend_t* backend);
+
+    static int compare_float(const void* a, const void* b);
+    static double now_ns(void);
+
+//********************************************************************************************************
+// Private variables
+//********************************************************************************************************
+
+    static const double percentiles[PERCENTILES] = {0.5, 0.9, 0.99, 0.999, 1.0};
+
+    static op_t* ops;
+    static size_t op_count;
+
+//  indexed by id
+    static void** live;
+    static size_t* live_sizes;
+    static unsigned id_count;
+
+//  the ids seen while loading, an open addressed hash table kept at most half full
+    static id_slot_t* id_slots;
+    static size_t id_slot_count;
+
+//  latency of each op
+    static float* latencies;
+
+//  errors reported by heaps.h since the start of a replay, and the first of them
+    static size_t error_count;
+    static const char* error_msg;
+    static const char* error_file;
+    static int error_line;
+
+    static const replay_backend_t replay_mcheap = {"mcheap", mcheap_allocate, mcheap_reallocate, mcheap_free_void, replay_mcheap_footprint, replay_mcheap_fragmentation};
+    static const replay_backend_t replay_malloc = {"malloc", malloc, realloc, free, replay_malloc_footprint, NULL};
+
+    static const replay_backend_t* const backends[] = {&replay_heaps_mcheap, &replay_mcheap, &replay_heaps_malloc, &replay_malloc};
+
+//********************************************************************************************************
+// Public functions
+//********************************************************************************************************
+
+int main(int argc, const char* argv[])
+{
+    const replay_backend_t* selected[sizeof(backends)/sizeof(*backends)];
+    int selected_count = 0;
+    result_t result;
+    int i,j;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: replay <trace> [backend ...]\n\n");
+        fprintf(stderr, "backends:");
+        for(j=0; j != sizeof(backends)/sizeof(*backends); j++)
+            fprintf(stderr, " %s", backends[j]->name);
+        fprintf(stderr, " (default all)\n\n");
+        fprintf(stderr, "The trace is text, with one operation per line:\n");
+        fprintf(stderr, "    a <id> <size>   allocate size bytes as id\n");
+        fprintf(stderr, "    r <id> <size>   reallocate id to size bytes\n");
+        fprintf(stderr, "    f <id>          free id\n");
+        fprintf(stderr, "An id may be any number, and may only be allocated again once it has been freed.\n");
+        fprintf(stderr, "Blank lines, and lines starting with #, are ignored.\n");
+        return EXIT_FAILURE;
+    };
+
+    for(i=2; i < argc; i++)
+    {
+        for(j=0; j != sizeof(backends)/sizeof(*backends); j++)
+        {
+            if(!strcmp(argv[i], backends[j]->name))
+                break;
+        };
+        if(j == sizeof(backends)/sizeof(*backends))
+        {
+            fprintf(stderr, "unknown backend %s\n", argv[i]);
+            return EXIT_FAILURE;
+        };
+        if(selected_count != (int)(sizeof(selected)/sizeof(*selected)))
+            selected[selected_count++] = backends[j];
+    };
+    if(!selected_count)
+    {
+        for(j=0; j != sizeof(backends)/sizeof(*backends); j++)
+            selected[selected_count++] = backends[j];
+    };
+
+    if(!load(argv[1]))
+        return EXIT_FAILURE;
+
+    printf("\nReplaying %zu operations on %u ids from %s\n", op_count, id_count, argv[1]);
+    printf("Latency is per operation, footprint is bytes taken from the underlying heap including all meta data,\n");
+    printf("fragmentation is the worst 1 - largest free / total free of mcheap's %u byte heap.\n\n", (unsigned)MCHEAP_SIZE);
+
+    printf("%16s%12s%10s%10s%10s%10s%10s%10s%16s%16s%10s\n", "backend", "ops/s", "p50", "p90", "p99", "p99.9", "max", "failed", "peak request", "peak footprint", "frag");
+    for(i=0; i != selected_count; i++)
+    {
+        replay(selected[i], &result);
+        printf("%16s%11.2fM", selected[i]->name, result.ops_per_sec / 1e6);
+        for(j=0; j != PERCENTILES; j++)
+            printf("%8.0fns", result.latency[j]);
+        printf("%10zu%16zu", result.failures, result.peak_requested);
+        if(selected[i]->footprint)
+            printf("%16zu", result.peak_footprint);
+        else
+            printf("%16s", "-");
+        if(selected[i]->fragmentation)
+            printf("%9.1f%%", result.fragmentation * 100);
+        else
+            printf("%10s", "-");
+        printf("\n");
+        if(result.errors)
+            printf("%16s heaps reported %zu error%s, the first was \"%s\" at %s:%i\n", "", result.errors, (result.errors == 1) ? "" : "s", error_msg, error_file, error_line);
+        fflush(stdout);
+    };
+    printf("\n");
+
+    free(latencies);
+    free(live_sizes);
+    free(live);
+    free(ops);
+    return EXIT_SUCCESS;
+}
+
+size_t replay_mcheap_footprint(void)
+{
+    return MCHEAP_SIZE - mcheap_total_free();
+}
+
+double replay_mcheap_fragmentation(void)
+{
+    size_t total = mcheap_total_free();
+    return total ? 1.0 - (double)mcheap_largest_free() / total : 0;
+}
+
+void replay_error_handler(const char* msg, const char* file, int line)
+{
+    if(!error_count++)
+    {
+        error_msg = msg;
+        error_file = file;
+        error_line = line;
+    };
+}
+
+size_t replay_malloc_footprint(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    // blocks large enough to be mmap()ed aren't in the arena's count
+    return info.uordblks + info.hblkhd;
+}
+
+//********************************************************************************************************
+// Private functions
+//********************************************************************************************************
+
+static void mcheap_free_void(void* ptr)
+{
+    mcheap_free(ptr);
+}
+
+static bool load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    char line[128];
+    size_t capacity = 0;
+    size_t line_number = 0;
+    unsigned long id;
+    id_slot_t* slot;
+    op_t op;
+    int fields;
+
+    if(!file)
+    {
+        perror(path);
+        return false;
+    };
+
+    while(fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        op.size = 0;
+        fields = sscanf(line, " %c %lu %zu", &op.op, &id, &op.size);
+        if(fields < 1 || op.op == '#')
+            continue;
+
+        if(!((op.op == 'a' || op.op == 'r') && fields == 3) && !(op.op == 'f' && fields >= 2))
+        {
+            fprintf(stderr, "%s:%zu: can't parse %s", path, line_number, line);
+            fclose(file);
+            return false;
+        };
+
+        slot = find_id(id);
+        if(op.op == 'a' && slot->live)
+        {
+            fprintf(stderr, "%s:%zu: id %lu is allocated again before it is freed\n", path, line_number, id);
+            fclose(file);
+            return false;
+        };
+        // a realloc to 0 bytes frees, unless there is nothing to free
+        slot->live = (op.op == 'a') || (op.op == 'r' && (op.size || !slot->live));
+        op.id = slot->index - 1;
+
+        if(op_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            ops = realloc(ops, capacity * sizeof(op_t));
+        };
+        ops[op_count++] = op;
+    };
+    fclose(file);
+    free(id_slots);
+
+    live = calloc(id_count, sizeof(void*));
+    live_sizes = calloc(id_count, sizeof(size_t));
+    latencies = malloc((op_count ? op_count : 1) * sizeof(float));
+    return true;
+}
+
+static id_slot_t* find_id(unsigned long id)
+{
+    id_slot_t* old = id_slots;
+    size_t old_count = id_slot_count;
+    id_slot_t* slot;
+    size_t i;
+
+    if(id_count >= id_slot_count / 2)
+    {
+        id_slot_count = id_slot_count ? id_slot_count * 2 : 1024;
+        id_slots = calloc(id_slot_count, sizeof(id_slot_t));
+        for(i=0; i != old_count; i++)
+        {
+            if(old[i].index)
+                *probe_id(old[i].id) = old[i];
+        };
+        free(old);
+    };
+
+    slot = probe_id(id);
+    if(!slot->index)
+    {
+        slot->id = id;
+        slot->index = ++id_count;
+    };
+    return slot;
+}
+
+static id_slot_t* probe_id(unsigned long id)
+{
+    size_t i = (id * 2654435761u) & (id_slot_count - 1);
+    while(id_slots[i].index && id_slots[i].id != id)
+        i = (i + 1) & (id_slot_count - 1);
+    return &id_slots[i];
+}
+
+static void replay(const replay_backend_t* backend, result_t* result)
+{
+    size_t requested = 0;
+    size_t footprint;
+    double fragmentation;
+    double start;
+    size_t i;
+    int j;
+
+    memset(result, 0, sizeof(result_t));
+    error_count = 0;
+
+    // footprint, sampled after every op, untimed
+    mcheap_reinit();
+    for(i=0; i != op_count; i++)
+    {
+        requested -= live_sizes[ops[i].id];     // 0 for an alloc, as an id isn't allocated again while it's live
+        if(apply(backend, &ops[i]))
+            live_sizes[ops[i].id] = (ops[i].op == 'f') ? 0 : ops[i].size;
+        else
+        {
+            result->failures++;
+            live_sizes[ops[i].id] = (ops[i].op == 'a') ? 0 : live_sizes[ops[i].id];
+        };
+        requested += live_sizes[ops[i].id];
+        if(requested > result->peak_requested)
+            result->peak_requested = requested;
+
+        if(backend->footprint)
+        {
+            footprint = backend->footprint();
+            if(footprint > result->peak_footprint)
+                result->peak_footprint = footprint;
+        };
+        if(backend->fragmentation)
+        {
+            fragmentation = backend->fragmentation();
+            if(fragmentation > result->fragmentation)
+                result->fragmentation = fragmentation;
+        };
+    };
+    release(backend);
+    memset(live_sizes, 0, id_count * sizeof(size_t));
+    result->errors = error_count;
+
+    // throughput
+    mcheap_reinit();
+    start = now_ns();
+    for(i=0; i != op_count; i++)
+        apply(backend, &ops[i]);
+    result->ops_per_sec = op_count / ((now_ns() - start) / 1e9);
+    release(backend);
+
+    // latency of each op
+    mcheap_reinit();
+    for(i=0; i != op_count; i++)
+    {
+        start = now_ns();
+        apply(backend, &ops[i]);
+        latencies[i] = now_ns() - start;
+    };
+    release(backend);
+
+    if(op_count)
+    {
+        qsort(latencies, op_count, sizeof(float), compare_float);
+        for(j=0; j != PERCENTILES; j++)
+            result->latency[j] = latencies[(size_t)(percentiles[j] * (op_count - 1))];
+    };
+}
+
+static bool apply(const replay_backend_t* backend, const op_t* op)
+{
+    void* ptr;
+
+    switch(op->op)
+    {
+        case 'a':
+            live[op->id] = backend->alloc(op->size);
+            return live[op->id] || !op->size;
+
+        case 'r':
+            // on failure the original allocation is left live
+            ptr = backend->realloc(live[op->id], op->size);
+            if(!ptr && op->size)
+                return false;
+            live[op->id] = ptr;
+            return true;
+
+        default:
+            backend->free(live[op->id]);
+            live[op->id] = NULL;
+            return true;
+    };
+}
+
+static void release(const replay_backend_t* backend)
+{
+    unsigned id;
+
+    for(id=0; id != id_count; id++)
+    {
+        if(live[id])
+        {
+            backend->free(live[id]);
+            live[id] = NULL;
+        };
+    };
+}
+
+static int compare_float(const void* a, const void* b)
+{
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
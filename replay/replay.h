@@ -0,0 +1,41 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+    #include <stddef.h>
+
+//********************************************************************************************************
+// Public defines
+//********************************************************************************************************
+
+//	An allocator which a trace can be replayed on. The heaps configurations are each built in their own source file
+//	with HEAPS_SANDBOX, the raw backends are in replay.c.
+    typedef struct replay_backend_t
+    {
+        const char* name;
+        void* (*alloc)(size_t size);
+        void* (*realloc)(void* ptr, size_t size);
+        void (*free)(void* ptr);
+        size_t (*footprint)(void);		// bytes taken from the underlying heap, including all meta data, NULL if it can't be measured
+        double (*fragmentation)(void);	// 1 - largest free / total free of the underlying heap, NULL if it can't be measured
+    } replay_backend_t;
+
+//********************************************************************************************************
+// Public variables
+//********************************************************************************************************
+
+    extern const replay_backend_t replay_heaps_mcheap;		// heaps.h (HEAPS_DOUBLY_LINKED) on mcheap
+    extern const replay_backend_t replay_heaps_malloc;		// heaps.h (HEAPS_DOUBLY_LINKED) on the C library's malloc
+
+//********************************************************************************************************
+// Public prototypes
+//********************************************************************************************************
+
+//	Measure mcheap's heap, or the C library's
+    size_t replay_mcheap_footprint(void);
+    double replay_mcheap_fragmentation(void);
+    size_t replay_malloc_footprint(void);
+
+//	The heaps_error_handler() of both heaps configurations, counts the errors of a replay and keeps the first
+    void replay_error_handler(const char* msg, const char* file, int line);
+
+#endif
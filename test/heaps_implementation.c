@@ -14,6 +14,10 @@
     #define heaps_platform_check()              mcheap_is_intact()
     #define heaps_platform_largest_free()       mcheap_largest_free()
 
+//  needed by HEAPS_SIDE_TABLE, mcheap's heap is a single region
+    #define heaps_platform_base()               mcheap_base()
+    #define HEAPS_SIDE_TABLE_SPAN               MCHEAP_SIZE
+
 //  as this is a test case the error handler simply passes info to the test, instead of aborting
     extern void test_error_handler(const char* msg, const char* file, int line);
     #define heaps_error_handler(msg,file,line)    test_error_handler(msg,file,line)
@@ -28,6 +32,10 @@
     #define heaps_platform_lock()      do{test_lock_entry_count++;}while(0)
     #define heaps_platform_unlock()      do{test_lock_exit_count++;}while(0)
 
+//  with HEAPS_SHARDS the shard locks are used instead, the tests are single threaded so these only count too
+    #define heaps_platform_shard_lock(i)      do{test_lock_entry_count++;}while(0)
+    #define heaps_platform_shard_unlock(i)    do{test_lock_exit_count++;}while(0)
+
 //  With HEAPS_IMPLEMENTATION defined heaps.h will provide the implementation (all functions)
     #define HEAPS_IMPLEMENTATION
     #include "../heaps.h"
@@ -147,6 +147,9 @@
 // 	Find largest free block. Used for tracking heap headroom.
 	static size_t free_find_largest(void);
 
+// 	Sum the sizes of the free sections, including their meta data.
+	static size_t free_find_total(void);
+
 // 	Heap test, return true if the heap is intact.
 	static bool heap_test(void);
 
@@ -186,6 +189,16 @@ size_t mcheap_largest_free(void)
 	return free_find_largest();
 }
 
+size_t mcheap_total_free(void)
+{
+	return free_find_total();
+}
+
+void* mcheap_base(void)
+{
+	return heap_space;
+}
+
 bool mcheap_is_intact(void)
 {
 	return heap_test();
@@ -569,6 +582,22 @@ static size_t free_find_largest(void)
 	return largest;
 }
 
+static size_t free_find_total(void)
+{
+	struct free_struct *free_ptr = first_free;
+	size_t total=0;
+
+	if(!initialized)
+		total = MCHEAP_SIZE;
+	while(free_ptr)
+	{
+		total += SECTION_SIZE(free_ptr);
+		free_ptr = free_ptr->next_ptr;
+	};
+
+	return total;
+}
+
 // Heap test, may be used before freeing memory, to see if the heap is intact,
 static bool heap_test(void)	
 {
@@ -60,6 +60,12 @@ MCHEAP_ADDRESS
 //	Return largest possible allocation that can currently be made.
 	size_t  mcheap_largest_free(void);
 
+//	Return the total size of the free sections, including their meta data.
+	size_t  mcheap_total_free(void);
+
+//	Return the start of the heap space, every allocation is within MCHEAP_SIZE bytes after this.
+	void*	mcheap_base(void);
+
 //	Return true if all the heap meta data is valid and intact.
 	bool	mcheap_is_intact(void);
 
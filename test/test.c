@@ -5,6 +5,10 @@
     #include "greatest.h"
     #include "../heaps.h"
 
+    #if (defined HEAPS_PER_THREAD || defined HEAPS_THREAD_CACHE || defined HEAPS_LOCK_FREE_REPORT || defined HEAPS_TRACE)
+        #include <pthread.h>
+    #endif
+
     #ifdef HEAPS_REALLOC_ZERO_DOESNT_FREE
         #error "Sorry but HEAPS_REALLOC_ZERO_DOESNT_FREE isn't supported by the tests" 
     #endif
@@ -22,6 +26,14 @@
         int line;
     } err_info_t;
 
+//  what the other thread in test_per_thread() did
+    typedef struct per_thread_t
+    {
+        void* to_free;          // an allocation for it to free
+        void* allocated;        // an allocation it made
+        int count;              // the allocation count after it freed to_free
+    } per_thread_t;
+
 //********************************************************************************************************
 // Public variables 
 //********************************************************************************************************
@@ -40,16 +52,73 @@
 //********************************************************************************************************
 
 	SUITE(suite_all_tests);
+	SUITE(suite_sampled);
 	TEST test_gen_linked_list(void);
+	TEST test_iterate_allocations(void);
 	TEST test_err_on_alloc_fail(void);
 	TEST test_err_on_realloc_fail(void);
 	TEST test_err_on_bad_free(void);
+	TEST test_err_on_double_free(void);
+	TEST test_err_on_corrupt_header(void);
+	TEST test_walk_check(void);
+	TEST test_check_step(void);
     TEST test_track_headroom(void);
     TEST test_track_peak_allocation_count(void);
     TEST test_calloc(void);
     TEST test_realloc(void);
     TEST test_reports(void);
+    TEST test_report_same_line(void);
+    TEST test_report_into(void);
+    TEST test_report_snapshot(void);
+    TEST test_report_sampled(void);
+    TEST test_site_peaks(void);
+    TEST test_lifetimes(void);
+    TEST test_trace(void);
+    TEST test_compact_header(void);
+    TEST test_side_table(void);
     TEST test_locking(void);
+    TEST test_per_thread(void);
+    TEST test_instances(void);
+    TEST test_batch(void);
+    TEST test_arena(void);
+    TEST test_arena_too_large(void);
+    TEST test_stats(void);
+    TEST test_slab(void);
+    TEST test_thread_cache(void);
+    TEST test_sampling(void);
+
+//  Find the heaps_t of an allocation by iterating them
+    static heaps_t* find_meta(void* ptr);
+
+//  Whether a report entry's count or size is as expected, or with a sampling interval set, an estimate within it's error of it
+    static bool report_count_is(const heaps_report_t* entry, int count);
+    static bool report_size_is(const heaps_report_t* entry, size_t size);
+
+//  Thread for test_per_thread()
+    static void* per_thread_main(void* arg);
+
+//  Thread for test_per_thread(), which has never allocated, and frees the pointer at arg
+    static void* bogus_free_thread_main(void* arg);
+
+//  Thread for test_thread_cache(), which frees and reuses a block then exits
+    static void* cache_thread_main(void* arg);
+
+//  Thread for test_report_snapshot(), which allocates and frees 24 bytes at a time from one source location until *arg is set
+    static void* snapshot_thread_main(void* arg);
+
+//  Thread for test_trace(), which makes and frees one allocation
+    static void* trace_thread_main(void* arg);
+
+//  Callback for test_report_into() and test_sampling(), which copies each entry to the next element of the report_copy_t at context
+    typedef struct report_copy_t {heaps_report_t entries[32]; int size;} report_copy_t;
+    static void report_copy(const heaps_report_t* entry, void* context);
+
+//  Backend for test_instances(), context points to it's lock count
+    static void* instance_alloc(void* context, size_t size);
+    static void* instance_realloc(void* context, void* ptr, size_t size);
+    static void instance_free(void* context, void* ptr);
+    static void instance_lock(void* context);
+    static void instance_unlock(void* context);
 
 //********************************************************************************************************
 // Public functions
@@ -65,7 +134,13 @@ void test_error_handler(const char* msg, const char* file, int line)
 int main(int argc, const char* argv[])
 {
 	GREATEST_MAIN_BEGIN();
+#ifdef HEAPS_SAMPLING
+	heaps_set_sampling_interval(0);		// the other tests expect every allocation to be tracked
+#endif
 	RUN_SUITE(suite_all_tests);
+#ifdef HEAPS_SAMPLING
+	RUN_SUITE(suite_sampled);
+#endif
 	GREATEST_MAIN_END();
 
 	return 0;
@@ -81,12 +156,51 @@ SUITE(suite_all_tests)
 	RUN_TEST(test_err_on_alloc_fail);
 	RUN_TEST(test_err_on_realloc_fail);
     RUN_TEST(test_err_on_bad_free);
+    RUN_TEST(test_err_on_double_free);
+    RUN_TEST(test_err_on_corrupt_header);
     RUN_TEST(test_track_headroom);
     RUN_TEST(test_track_peak_allocation_count);
     RUN_TEST(test_calloc);
     RUN_TEST(test_realloc);
     RUN_TEST(test_reports);
+    RUN_TEST(test_report_same_line);
+    RUN_TEST(test_report_into);
+    RUN_TEST(test_report_snapshot);
+    RUN_TEST(test_report_sampled);
+    RUN_TEST(test_site_peaks);
+    RUN_TEST(test_lifetimes);
+    RUN_TEST(test_trace);
+    RUN_TEST(test_compact_header);
+    RUN_TEST(test_side_table);
     RUN_TEST(test_locking);
+    RUN_TEST(test_per_thread);
+    RUN_TEST(test_instances);
+    RUN_TEST(test_batch);
+    RUN_TEST(test_arena);
+    RUN_TEST(test_arena_too_large);
+    RUN_TEST(test_stats);
+    RUN_TEST(test_slab);
+    RUN_TEST(test_thread_cache);
+    RUN_TEST(test_sampling);
+    RUN_TEST(test_iterate_allocations);     // these are after test_track_peak_allocation_count, as they raise the peak
+    RUN_TEST(test_walk_check);
+    RUN_TEST(test_check_step);
+}
+
+// The tests which don't depend on every allocation being tracked, again with both sampled and unsampled allocations
+SUITE(suite_sampled)
+{
+#ifdef HEAPS_SAMPLING
+	heaps_set_sampling_interval(256);
+	RUN_TEST(test_err_on_bad_free);
+	RUN_TEST(test_err_on_double_free);
+	RUN_TEST(test_calloc);
+	RUN_TEST(test_realloc);
+	RUN_TEST(test_reports);
+	RUN_TEST(test_batch);
+	RUN_TEST(test_arena);
+	heaps_set_sampling_interval(0);
+#endif
 }
 
 TEST test_gen_linked_list(void)
@@ -94,50 +208,53 @@ TEST test_gen_linked_list(void)
     heaps_t* ptr = NULL;
     heaps_t* old_head = heaps_get_allocation_list();
     void *a,*b,*c;
+#if (defined HEAPS_HASH_TABLE || defined HEAPS_SIDE_TABLE || defined HEAPS_SHARDS)
+    SKIPm("allocation order is not kept with HEAPS_HASH_TABLE, HEAPS_SIDE_TABLE or HEAPS_SHARDS");
+#endif
     a = heaps_alloc_(101, "file-one", 1);
     b = heaps_alloc_(102, "file-two", 2);
     c = heaps_alloc_(103, "file-three", 3);
     ptr = heaps_get_allocation_list();
     ASSERT(ptr);
-    ASSERT_STR_EQ("file-three", ptr->file);
-    ASSERT_EQ(3, ptr->line);
+    ASSERT_STR_EQ("file-three", heaps_file_of(ptr));
+    ASSERT_EQ(3, heaps_line_of(ptr));
     ASSERT_EQ(103, ptr->size);
-    ptr = ptr->next;
+    ptr = heaps_get_next_allocation(ptr);
     ASSERT(ptr);
-    ASSERT_STR_EQ("file-two", ptr->file);
-    ASSERT_EQ(2, ptr->line);
+    ASSERT_STR_EQ("file-two", heaps_file_of(ptr));
+    ASSERT_EQ(2, heaps_line_of(ptr));
     ASSERT_EQ(102, ptr->size);
-    ptr = ptr->next;
+    ptr = heaps_get_next_allocation(ptr);
     ASSERT(ptr);
-    ASSERT_STR_EQ("file-one", ptr->file);
-    ASSERT_EQ(1, ptr->line);
+    ASSERT_STR_EQ("file-one", heaps_file_of(ptr));
+    ASSERT_EQ(1, heaps_line_of(ptr));
     ASSERT_EQ(101, ptr->size);
-    ptr = ptr->next;
+    ptr = heaps_get_next_allocation(ptr);
     ASSERT_EQ(old_head, ptr);
 
 //  remove the middle allocation, and re-test the list is what it should be
     heaps_free(b);
     ptr = heaps_get_allocation_list();
     ASSERT(ptr);
-    ASSERT_STR_EQ("file-three", ptr->file);
-    ASSERT_EQ(3, ptr->line);
+    ASSERT_STR_EQ("file-three", heaps_file_of(ptr));
+    ASSERT_EQ(3, heaps_line_of(ptr));
     ASSERT_EQ(103, ptr->size);
-    ptr = ptr->next;
+    ptr = heaps_get_next_allocation(ptr);
     ASSERT(ptr);
-    ASSERT_STR_EQ("file-one", ptr->file);
-    ASSERT_EQ(1, ptr->line);
+    ASSERT_STR_EQ("file-one", heaps_file_of(ptr));
+    ASSERT_EQ(1, heaps_line_of(ptr));
     ASSERT_EQ(101, ptr->size);
-    ptr = ptr->next;
+    ptr = heaps_get_next_allocation(ptr);
     ASSERT_EQ(old_head, ptr);
  
 //  remove the last allocation, and re-test the list is what it should be
     heaps_free(c);
     ptr = heaps_get_allocation_list();
     ASSERT(ptr);
-    ASSERT_STR_EQ("file-one", ptr->file);
-    ASSERT_EQ(1, ptr->line);
+    ASSERT_STR_EQ("file-one", heaps_file_of(ptr));
+    ASSERT_EQ(1, heaps_line_of(ptr));
     ASSERT_EQ(101, ptr->size);
-    ptr = ptr->next;
+    ptr = heaps_get_next_allocation(ptr);
     ASSERT_EQ(old_head, ptr);
 
 //  remove the first allocation, and re-test the list is what it should be
@@ -148,6 +265,44 @@ TEST test_gen_linked_list(void)
     PASS();
 }
 
+TEST test_iterate_allocations(void)
+{
+    void* ptrs[200];
+    heaps_t* link;
+    int count = heaps_get_allocation_count();
+    int found;
+    int i;
+
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    for(i=0; i!=200; i++)
+        ptrs[i] = heaps_alloc(i+1);
+    for(i=0; i<200; i+=2)
+        heaps_free(ptrs[i]);
+    ASSERT_EQ(count+100, heaps_get_allocation_count());
+
+    for(i=1; i<200; i+=2)
+    {
+        found = 0;
+        link = heaps_get_allocation_list();
+        while(link)
+        {
+            if(heaps_content_of(link) == ptrs[i])
+            {
+                found++;
+                ASSERT_EQ((size_t)i+1, link->size);
+            };
+            link = heaps_get_next_allocation(link);
+        };
+        ASSERT_EQ(1, found);
+    };
+
+    for(i=1; i<200; i+=2)
+        heaps_free(ptrs[i]);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+}
+
 TEST test_err_on_alloc_fail(void)
 {
     void* a;
@@ -205,6 +360,163 @@ TEST test_err_on_bad_free(void)
     PASS();
 }
 
+TEST test_err_on_double_free(void)
+{
+    void* a = heaps_alloc(10);
+    void* b = heaps_alloc(10);
+    void* c = heaps_alloc(10);
+    int count = heaps_get_allocation_count();
+    ASSERT_NEQ(NULL, b);
+    heaps_free(b);
+    ASSERT_EQ(count-1, heaps_get_allocation_count());
+    heaps_free_(b, "trying double free", 1990);
+    ASSERT_STR_EQ("trying double free", err_info.file);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_EQ(1990, err_info.line);
+    ASSERT_EQ(count-1, heaps_get_allocation_count());
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    heaps_free(a);
+    heaps_free(c);
+    PASS();
+}
+
+TEST test_err_on_corrupt_header(void)
+{
+#ifndef HEAPS_HEADER_CHECKSUM
+    SKIPm("requires HEAPS_HEADER_CHECKSUM");
+#else
+    void* a = heaps_alloc(10);
+    void* b = heaps_alloc(10);
+    void* c = heaps_alloc(10);
+    heaps_t* meta = find_meta(b);
+    int count = heaps_get_allocation_count();
+
+    // an overwrite of b's meta data must be caught when freeing b
+    meta->size ^= 1;
+    heaps_free_(b, "freeing corrupt allocation", 2020);
+    ASSERT_STR_EQ("freeing corrupt allocation", err_info.file);
+    ASSERT_STR_EQ("heap broken", err_info.msg);
+    ASSERT_EQ(2020, err_info.line);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+
+#if (!defined HEAPS_HASH_TABLE && !defined HEAPS_SIDE_TABLE && !defined HEAPS_SHARDS)
+    // and when freeing an allocation linked to it
+    heaps_free_(c, "freeing neighbour of corrupt allocation", 2021);
+    ASSERT_STR_EQ("freeing neighbour of corrupt allocation", err_info.file);
+    ASSERT_STR_EQ("heap broken", err_info.msg);
+    ASSERT_EQ(2021, err_info.line);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+#endif
+
+    meta->size ^= 1;
+    heaps_free(a);
+    heaps_free(b);
+    heaps_free(c);
+    ASSERT_STR_EQ("", err_info.msg);
+    ASSERT_EQ(count-3, heaps_get_allocation_count());
+    PASS();
+#endif
+}
+
+TEST test_walk_check(void)
+{
+#if (defined HEAPS_NO_PRE_OPERATION_WALK_CHECK || defined HEAPS_HASH_TABLE || defined HEAPS_SIDE_TABLE || defined HEAPS_CHECKER_THREAD || defined HEAPS_SHARDS || defined HEAPS_PER_THREAD || (defined HEAPS_HEADER_CHECKSUM && !defined HEAPS_WALK_CHECK_BUDGET))
+    SKIPm("requires the pre-operation walk of a linked list");
+#else
+    void* ptrs[10];
+    void* a;
+    heaps_t* middle;
+    __typeof__(middle->next) after_middle;     // a pointer, or an offset with HEAPS_COMPACT_HEADER
+    size_t passes;
+    int i;
+
+    for(i=0; i!=10; i++)
+        ptrs[i] = heaps_alloc(10);
+
+    // every allocation must be walked over enough operations
+    passes = heaps_get_walk_pass_count();
+    for(i=0; i!=20; i++)
+        heaps_free(heaps_alloc(10));
+    ASSERT_LT(passes, heaps_get_walk_pass_count());
+    ASSERT_STR_EQ("", err_info.msg);
+
+    // cut the list short, this must be found by a later operation
+    middle = (heaps_t*)((uint8_t*)ptrs[5] - offsetof(heaps_t, content));
+    after_middle = middle->next;
+    middle->next = 0;
+    for(i=0; i!=40 && !strcmp("", err_info.msg); i++)
+    {
+        a = heaps_alloc_(10, "walking a broken list", 2022);
+        heaps_free_(a, "walking a broken list", 2022);  // a is at the head, so is found without following the broken link
+    };
+    middle->next = after_middle;
+    ASSERT_STR_EQ("walking a broken list", err_info.file);
+    ASSERT_STR_EQ("heap broken", err_info.msg);
+    ASSERT_EQ(2022, err_info.line);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+
+    for(i=0; i!=10; i++)
+        heaps_free(ptrs[i]);
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+TEST test_check_step(void)
+{
+#if (defined HEAPS_HASH_TABLE || defined HEAPS_SIDE_TABLE)
+    SKIPm("requires a linked list");
+#else
+    void* ptrs[10];
+    heaps_t* middle;
+    __typeof__(middle->next) after_middle;     // a pointer, or an offset with HEAPS_COMPACT_HEADER
+    int i;
+
+    for(i=0; i!=10; i++)
+        ptrs[i] = heaps_alloc_(10, "check step", 3000+i);
+    for(i=0; i!=40; i++)
+        ASSERT(heaps_check_step());
+    ASSERT_STR_EQ("", err_info.msg);
+
+    // cut the list short, the error should report the allocation where the list was cut
+    middle = (heaps_t*)((uint8_t*)ptrs[5] - offsetof(heaps_t, content));
+#ifdef HEAPS_SHARDS
+    // ptrs[5] may be the last in it's shard, in which case there is nothing to cut
+    for(i=0; i!=10 && !middle->next; i++)
+        middle = (heaps_t*)((uint8_t*)ptrs[i] - offsetof(heaps_t, content));
+#endif
+    after_middle = middle->next;
+    middle->next = 0;
+    for(i=0; i!=40 && heaps_check_step(); i++);
+    middle->next = after_middle;
+    ASSERT_STR_EQ("heap broken", err_info.msg);
+#if (defined HEAPS_HEADER_CHECKSUM && defined HEAPS_SHARDS)
+    // the last intact allocation is whichever precedes ptrs[5] in it's shard, if any
+#elif (defined HEAPS_HEADER_CHECKSUM)
+    ASSERT_STR_EQ("check step", err_info.file);
+    ASSERT_EQ(3006, err_info.line);     // cutting the list broke the checksum of ptrs[5], so the last intact one is ptrs[6]
+#else
+    ASSERT_STR_EQ("check step", err_info.file);
+    ASSERT_EQ(heaps_line_of(middle), err_info.line);
+#endif
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+
+#ifdef HEAPS_CHECKER_THREAD
+    ASSERT(heaps_checker_start(100));
+    ASSERT_FALSE(heaps_checker_start(100));
+    heaps_checker_stop();
+    ASSERT_STR_EQ("", err_info.msg);
+#endif
+
+    for(i=0; i!=10; i++)
+        heaps_free(ptrs[i]);
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
 TEST test_track_headroom(void)
 {
     void* a;
@@ -297,6 +609,7 @@ TEST test_reports(void)
 
     heaps_report_t* arr;
     int arr_size = -1;
+    int i;
     arr = heaps_report(&arr_size);  //call with NO allocations made
     ASSERT_EQ(NULL, arr);
     ASSERT_EQ(0, arr_size);
@@ -311,64 +624,477 @@ TEST test_reports(void)
     
     ASSERT_EQ(4, arr_size);
 
+#if (!defined HEAPS_HASH_TABLE && !defined HEAPS_SITE_COUNTERS && !defined HEAPS_SHARDS && !defined HEAPS_PER_THREAD)
     ASSERT_STR_EQ("fileA", arr[2].file);
-    ASSERT(arr[2].count == 1);
+    ASSERT(report_count_is(&arr[2], 1));
     ASSERT(arr[2].line == 2001);
-    ASSERT(arr[2].size == 3000);
+    ASSERT(report_size_is(&arr[2], 3000));
 
     ASSERT_STR_EQ("fileB", arr[1].file);
-    ASSERT(arr[1].count == 2);
+    ASSERT(report_count_is(&arr[1], 2));
     ASSERT(arr[1].line == 2002);
-    ASSERT(arr[1].size == 2000);
+    ASSERT(report_size_is(&arr[1], 2000));
 
     ASSERT_STR_EQ("fileC", arr[0].file);
-    ASSERT(arr[0].count == 3);
+    ASSERT(report_count_is(&arr[0], 3));
     ASSERT(arr[0].line == 2003);
-    ASSERT(arr[0].size == 1500);
+    ASSERT(report_size_is(&arr[0], 1500));
 
     ASSERT_STR_EQ("../heaps.h", arr[3].file);
+#endif
 
+#ifdef HEAPS_LIFETIMES
+    // the report's own size depends on the size of it's entries, which are large with HEAPS_LIFETIMES
+    for(i=0; i!=arr_size; i++)
+        if(!strcmp("../heaps.h", arr[i].file))
+            arr[i].size = 0;
+#endif
     qsort(arr, arr_size, sizeof(*arr), heaps_report_sorter_descending_size);
 
     ASSERT_STR_EQ("fileA", arr[0].file);
-    ASSERT(arr[0].count == 1);
+    ASSERT(report_count_is(&arr[0], 1));
     ASSERT(arr[0].line == 2001);
-    ASSERT(arr[0].size == 3000);
+    ASSERT(report_size_is(&arr[0], 3000));
 
     ASSERT_STR_EQ("fileB", arr[1].file);
-    ASSERT(arr[1].count == 2);
+    ASSERT(report_count_is(&arr[1], 2));
     ASSERT(arr[1].line == 2002);
-    ASSERT(arr[1].size == 2000);
+    ASSERT(report_size_is(&arr[1], 2000));
 
     ASSERT_STR_EQ("fileC", arr[2].file);
-    ASSERT(arr[2].count == 3);
+    ASSERT(report_count_is(&arr[2], 3));
     ASSERT(arr[2].line == 2003);
-    ASSERT(arr[2].size == 1500);
+    ASSERT(report_size_is(&arr[2], 1500));
 
     ASSERT_STR_EQ("../heaps.h", arr[3].file);
 
     qsort(arr, arr_size, sizeof(*arr), heaps_report_sorter_descending_count);
 
     ASSERT_STR_EQ("fileC", arr[0].file);
-    ASSERT(arr[0].count == 3);
+    ASSERT(report_count_is(&arr[0], 3));
     ASSERT(arr[0].line == 2003);
-    ASSERT(arr[0].size == 1500);
+    ASSERT(report_size_is(&arr[0], 1500));
 
     ASSERT_STR_EQ("fileB", arr[1].file);
-    ASSERT(arr[1].count == 2);
+    ASSERT(report_count_is(&arr[1], 2));
     ASSERT(arr[1].line == 2002);
-    ASSERT(arr[1].size == 2000);
+    ASSERT(report_size_is(&arr[1], 2000));
 
-    ASSERT(arr[2].count == 1);  // fileA and the report itself could be in either order
-    ASSERT(arr[3].count == 1);
+    ASSERT(report_count_is(&arr[2], 1));  // fileA and the report itself could be in either order
+    ASSERT(report_count_is(&arr[3], 1));
+
+    heaps_free(arr);
 
+    // once all of a source location's allocations are freed, it is no longer reported
+    heaps_free(b1);
+    heaps_free(b2);
+    arr = heaps_report(&arr_size);
+    ASSERT_EQ(3, arr_size);
+    for(i=0; i!=arr_size; i++)
+        ASSERT(strcmp("fileB", arr[i].file));
     heaps_free(arr);
 
+    heaps_free(a1);
+    heaps_free(c1);
+    heaps_free(c2);
+    heaps_free(c3);
+    arr = heaps_report(&arr_size);
+    ASSERT_EQ(NULL, arr);
+    ASSERT_EQ(0, arr_size);
+
     PASS();
 }
 
+TEST test_report_same_line(void)
+{
+    void* ptrs[2];
+    int line = 0;
+    int i;
+    heaps_report_t* arr;
+    int arr_size = -1;
+
+    for(i=0; i!=2; i++)
+    {
+        line = __LINE__; ptrs[i] = heaps_alloc(100);
+    };
+    ASSERT_EQ(line, heaps_line_of(heaps_get_allocation_list()));
+    arr = heaps_report(&arr_size);
+    ASSERT_EQ(2, arr_size);    // the two allocations, and the report itself
+    for(i=0; i!=arr_size && arr[i].line != line; i++);
+    ASSERT(i != arr_size);
+    ASSERT_STR_EQ(__FILE__, arr[i].file);
+    ASSERT_EQ(2, arr[i].count);
+    ASSERT_EQ(200, arr[i].size);
+    heaps_free(arr);
+    heaps_free(ptrs[0]);
+    heaps_free(ptrs[1]);
+
+    PASS();
+}
+
+TEST test_report_into(void)
+{
+    static report_copy_t copy;
+    heaps_report_t buf[8];
+    void* ptrs[26];
+    int arr_size = -1;
+    int count = heaps_get_allocation_count();
+    int found = 0;
+    int i;
+
+    ASSERT(heaps_report_into(buf, 8, &arr_size));
+    ASSERT_EQ(0, arr_size);
+
+    ptrs[0] = heaps_alloc_(30, "fileC", 3003);
+    ptrs[1] = heaps_alloc_(10, "fileA", 3001);
+    ptrs[2] = heaps_alloc_(20, "fileB", 3002);
+    ptrs[3] = heaps_alloc_(20, "fileB", 3002);
+    ptrs[4] = heaps_alloc_(30, "fileC", 3003);
+    ptrs[5] = heaps_alloc_(30, "fileC", 3003);
+
+    // nothing is allocated to make the report
+    ASSERT(heaps_report_into(buf, 8, &arr_size));
+    ASSERT_EQ(count+6, heaps_get_allocation_count());
+    ASSERT_EQ(3, arr_size);
+    for(i=0; i!=arr_size; i++)
+    {
+        ASSERT_EQ(3000 + buf[i].count, buf[i].line);
+        ASSERT_EQ((size_t)(10*buf[i].count*buf[i].count), buf[i].size);
+    };
+
+    // the entries which fit are complete
+    ASSERT_FALSE(heaps_report_into(buf, 2, &arr_size));
+    ASSERT_EQ(2, arr_size);
+    for(i=0; i!=arr_size; i++)
+        ASSERT_EQ(3000 + buf[i].count, buf[i].line);
+
+    // more source locations than are gathered by one pass, are visited in order of file then line
+    for(i=6; i!=26; i++)
+        ptrs[i] = heaps_alloc_(1, "fileD", 3100 - i);
+    copy.size = 0;
+    heaps_report_foreach(report_copy, &copy);
+    ASSERT_EQ(count+26, heaps_get_allocation_count());
+    ASSERT(copy.size >= 23);
+    for(i=1; i!=copy.size; i++)
+        ASSERT(strcmp(copy.entries[i-1].file, copy.entries[i].file) < 0 || (!strcmp(copy.entries[i-1].file, copy.entries[i].file) && copy.entries[i-1].line < copy.entries[i].line));
+    for(i=0; i!=copy.size; i++)
+    {
+        if(!strcmp("fileD", copy.entries[i].file))
+        {
+            ASSERT_EQ(1, copy.entries[i].count);
+            ASSERT_EQ(3100 - 25 + found, copy.entries[i].line);
+            found++;
+        }
+        else if(!strncmp("file", copy.entries[i].file, 4))
+            ASSERT_EQ(3000 + copy.entries[i].count, copy.entries[i].line);
+    };
+    ASSERT_EQ(20, found);
+
+    for(i=0; i!=26; i++)
+        heaps_free(ptrs[i]);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    PASS();
+}
+
+TEST test_report_sampled(void)
+{
+#ifndef HEAPS_SAMPLING
+    SKIPm("requires HEAPS_SAMPLING");
+#else
+    static void* ptrs[4000];
+    heaps_report_t* arr;
+    int arr_size;
+    int count = heaps_get_allocation_count();
+    int i;
+    int j;
+
+    // most allocations are unsampled, but the report itself always is, so it's own entry can be taken from it's meta data
+    ptrs[0] = heaps_alloc_(64, "report sampled", 9100);
+    heaps_set_sampling_interval(65536);
+    for(i=1; i!=4000; i++)
+        ptrs[i] = heaps_alloc_(64, "report sampled", 9100);
+    for(i=0; i!=20; i++)
+    {
+        arr = heaps_report(&arr_size);
+        ASSERT(arr != NULL);
+        for(j=0; j!=arr_size && strcmp("../heaps.h", arr[j].file); j++);
+        ASSERT(j != arr_size);
+        heaps_free(arr);
+    };
+    heaps_set_sampling_interval(0);
+
+    for(i=0; i!=4000; i++)
+        heaps_free(ptrs[i]);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+TEST test_report_snapshot(void)
+{
+#ifndef HEAPS_LOCK_FREE_REPORT
+    SKIPm("requires HEAPS_LOCK_FREE_REPORT");
+#else
+    heaps_report_t buf[64];
+    heaps_report_t locked[64];
+    int arr_size;
+    int locked_size;
+    pthread_t thread;
+    bool stop = false;
+    void* ptrs[3];
+    int round;
+    int i;
+
+    // with nothing changing, the snapshot is the same as a locked report
+    ptrs[0] = heaps_alloc_(10, "fileA", 3201);
+    ptrs[1] = heaps_alloc_(20, "fileB", 3202);
+    ptrs[2] = heaps_alloc_(20, "fileB", 3202);
+    test_lock_entry_count = 0;
+    ASSERT(heaps_report_snapshot(buf, 64, &arr_size));
+    ASSERT_EQ(0, test_lock_entry_count);
+    ASSERT(heaps_report_into(locked, 64, &locked_size));
+    ASSERT_EQ(locked_size, arr_size);
+    ASSERT_MEM_EQ(locked, buf, arr_size * sizeof(heaps_report_t));
+    ASSERT_FALSE(heaps_report_snapshot(buf, 1, &arr_size));
+    ASSERT_EQ(1, arr_size);
+    for(i=0; i!=3; i++)
+        heaps_free(ptrs[i]);
+
+    // while another thread allocates, each entry's count and size agree
+    ASSERT_EQ(0, pthread_create(&thread, NULL, snapshot_thread_main, &stop));
+    for(round=0; round!=10000; round++)
+    {
+        ASSERT(heaps_report_snapshot(buf, 64, &arr_size));
+        for(i=0; i!=arr_size; i++)
+        {
+            if(buf[i].line == 3300)
+            {
+                ASSERT(buf[i].count >= 0 && buf[i].count <= 16);
+                ASSERT_EQ((size_t)buf[i].count*24, buf[i].size);
+            };
+        };
+    };
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    PASS();
+#endif
+}
+
+TEST test_site_peaks(void)
+{
+#ifndef HEAPS_SITE_PEAKS
+    SKIPm("requires HEAPS_SITE_PEAKS");
+#else
+    heaps_report_t buf[64];
+    int arr_size;
+    void* ptrs[3];
+    void* last;
+    int i;
+
+    for(i=0; i!=3; i++)
+        ptrs[i] = heaps_alloc_(10*(i+1), "peaks", 4001);
+    heaps_free(ptrs[0]);
+    heaps_free(ptrs[1]);
+    last = heaps_alloc_(5, "peaks", 4001);
+    heaps_free(ptrs[2]);
+    heaps_free(last);
+
+    // the site is only reported by heaps_report_peaks() with nothing allocated, and keeps it's peaks
+    ASSERT(heaps_report_into(buf, 64, &arr_size));
+    for(i=0; i!=arr_size && buf[i].line != 4001; i++);
+    ASSERT_EQ(arr_size, i);
+    ASSERT(heaps_report_peaks(buf, 64, &arr_size));
+    for(i=0; i!=arr_size && buf[i].line != 4001; i++);
+    ASSERT(i != arr_size);
+    ASSERT_STR_EQ("peaks", buf[i].file);
+    ASSERT_EQ(0, buf[i].count);
+    ASSERT_EQ(0, buf[i].size);
+    ASSERT_EQ(3, buf[i].count_peak);
+    ASSERT_EQ(60, buf[i].size_peak);
+    ASSERT_EQ(4, buf[i].total);
+#ifdef HEAPS_SAMPLING
+    // an idle site is left unscaled, with no error
+    ASSERT_EQ(0, buf[i].count_error);
+    ASSERT_EQ(0, buf[i].size_error);
+#endif
+    PASS();
+#endif
+}
+
+TEST test_lifetimes(void)
+{
+#ifndef HEAPS_LIFETIMES
+    SKIPm("requires HEAPS_LIFETIMES");
+#else
+    heaps_report_t buf[64];
+    int arr_size;
+    void* kept;
+    void* ptr;
+    void* others[5];
+    int i;
+
+    kept = heaps_alloc_(8, "lifetimes", 5001);     // keeps the site in the report
+    ptr = heaps_alloc_(8, "lifetimes", 5001);
+    heaps_free(ptr);                                // lifetime 0
+    ptr = heaps_alloc_(8, "lifetimes", 5001);
+    for(i=0; i!=5; i++)
+        others[i] = heaps_alloc_(8, "lifetimes", 5002);
+    heaps_free(ptr);                                // lifetime 5, in the bin for 4 to 7
+    for(i=0; i!=5; i++)
+        heaps_free(others[i]);
+
+    ASSERT(heaps_report_into(buf, 64, &arr_size));
+    for(i=0; i!=arr_size && buf[i].line != 5001; i++);
+    ASSERT(i != arr_size);
+    ASSERT_EQ(1, buf[i].count);
+    ASSERT_EQ(1, buf[i].lifetimes[0]);
+    ASSERT_EQ(0, buf[i].lifetimes[1] + buf[i].lifetimes[2]);
+    ASSERT_EQ(1, buf[i].lifetimes[3]);
+    heaps_free(kept);
+    PASS();
+#endif
+}
+
+TEST test_trace(void)
+{
+#ifndef HEAPS_TRACE
+    SKIPm("requires HEAPS_TRACE");
+#else
+    static heaps_trace_event_t buf[HEAPS_TRACE_THREADS*HEAPS_TRACE_EVENTS];
+    pthread_t thread;
+    size_t dropped;
+    size_t n;
+    void* a;
+    void* b;
+    void* c;
+    int i;
+
+    while(heaps_trace_drain(buf, 16));    // the events of earlier tests
+
+    a = heaps_alloc_(40, "trace", 6001);
+    b = heaps_realloc_(a, 80, "trace", 6002);
+    c = heaps_calloc_(3, 10, "trace", 6003);
+    heaps_free_(b, "trace", 6004);
+    heaps_free_(c, "trace", 6005);
+    heaps_free_(NULL, "trace", 6006);     // not traced
+
+    n = heaps_trace_drain(buf, 16);
+    ASSERT_EQ(5, n);
+    ASSERT_EQ(HEAPS_TRACE_ALLOC, buf[0].op);
+    ASSERT_EQ((uintptr_t)a, buf[0].ptr);
+    ASSERT_EQ(40, buf[0].size);
+    ASSERT_EQ(heaps_trace_site("trace", 6001), buf[0].site);
+    ASSERT_EQ(HEAPS_TRACE_REALLOC, buf[1].op);
+    ASSERT_EQ((uintptr_t)b, buf[1].ptr);
+    ASSERT_EQ((uintptr_t)a, buf[1].old);
+    ASSERT_EQ(80, buf[1].size);
+    ASSERT_EQ(HEAPS_TRACE_CALLOC, buf[2].op);
+    ASSERT_EQ((uintptr_t)c, buf[2].ptr);
+    ASSERT_EQ(30, buf[2].size);
+    ASSERT_EQ(HEAPS_TRACE_FREE, buf[3].op);
+    ASSERT_EQ((uintptr_t)b, buf[3].ptr);
+    ASSERT_EQ(HEAPS_TRACE_FREE, buf[4].op);
+    ASSERT_EQ(heaps_trace_site("trace", 6005), buf[4].site);
+    for(i=1; i!=5; i++)
+    {
+        ASSERT(buf[i].time > buf[i-1].time);
+        ASSERT_EQ(buf[0].thread, buf[i].thread);
+    };
+
+    // another thread traces to it's own ring
+    ASSERT_EQ(0, pthread_create(&thread, NULL, trace_thread_main, NULL));
+    pthread_join(thread, NULL);
+    ASSERT_EQ(2, heaps_trace_drain(buf, 16));
+    ASSERT(buf[0].thread != buf[4].thread || HEAPS_TRACE_THREADS == 1);
+    ASSERT_EQ(HEAPS_TRACE_ALLOC, buf[0].op);
+    ASSERT_EQ(HEAPS_TRACE_FREE, buf[1].op);
+    ASSERT_EQ(buf[0].ptr, buf[1].ptr);
+
+    // once the ring is full, events are dropped until it is drained
+    dropped = heaps_trace_dropped();
+    for(i=0; i!=HEAPS_TRACE_EVENTS/2 + 5; i++)
+        heaps_free(heaps_alloc(8));
+    ASSERT_EQ(dropped + 10, heaps_trace_dropped());
+    ASSERT_EQ(HEAPS_TRACE_EVENTS, heaps_trace_drain(buf, HEAPS_TRACE_THREADS*HEAPS_TRACE_EVENTS));
+    ASSERT_EQ(0, heaps_trace_drain(buf, 16));
+    PASS();
+#endif
+}
+
+TEST test_compact_header(void)
+{
+#ifndef HEAPS_COMPACT_HEADER
+    SKIPm("requires HEAPS_COMPACT_HEADER");
+#else
+    void* a = heaps_alloc_(20, "compact", 4000);
+    void* b = heaps_alloc_(20, "compact", 4001);
+    heaps_t* meta = (heaps_t*)((uint8_t*)a - offsetof(heaps_t, content));
+
+#ifndef HEAPS_LIFETIMES
+    ASSERT(sizeof(heaps_t) <= (__BIGGEST_ALIGNMENT__ > 16 ? __BIGGEST_ALIGNMENT__ : 16));
+#endif
+    ASSERT_STR_EQ("compact", heaps_get_site(meta)->file);
+    ASSERT_EQ(4000, heaps_get_site(meta)->line);
+    ASSERT_EQ(1, heaps_get_site(meta)->count);
+    ASSERT_EQ(20, heaps_get_site(meta)->size);
+    meta = (heaps_t*)((uint8_t*)b - offsetof(heaps_t, content));
+    ASSERT_EQ(4001, heaps_line_of(meta));
+    heaps_free(a);
+    heaps_free(b);
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+TEST test_side_table(void)
+{
+#ifndef HEAPS_SIDE_TABLE
+    SKIPm("requires HEAPS_SIDE_TABLE");
+#else
+    int on_stack;
+    uint8_t* a = heaps_alloc_(100, "side", 5000);
+    heaps_t* meta = find_meta(a);
+    void* z[2];
+
+    ASSERT(meta);
+    ASSERT_EQ(a, heaps_content_of(meta));
+    ASSERT_EQ(100, meta->size);
+    ASSERT_EQ(5000, heaps_line_of(meta));
+
+    // addresses inside the heap, and outside it, are rejected by the table alone
+    heaps_free_(a + __BIGGEST_ALIGNMENT__, "freeing inside an allocation", 5001);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_EQ(5001, err_info.line);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    heaps_free_(&on_stack, "freeing outside the heap", 5002);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_EQ(5002, err_info.line);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+
+    // without a header a 0 byte allocation still asks the allocator for a byte, and gets a block of it's own
+    z[0] = heaps_alloc_(0, "side", 5003);
+    z[1] = heaps_alloc_(0, "side", 5004);
+    ASSERT(z[0] != NULL);
+    ASSERT(z[1] != NULL);
+    ASSERT(z[0] != z[1]);
+    ASSERT_EQ(0, find_meta(z[0])->size);
+    ASSERT_EQ(5004, heaps_line_of(find_meta(z[1])));
+    heaps_free(z[0]);
+    heaps_free(z[1]);
+
+    heaps_free(a);
+    ASSERT_EQ(NULL, find_meta(a));
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
 TEST test_locking(void)
 {
+#ifdef HEAPS_PER_THREAD
+    SKIPm("no lock is used with HEAPS_PER_THREAD");
+#else
     void *ptr;
     test_lock_entry_count = 0;
     test_lock_exit_count = 0;
@@ -376,6 +1102,10 @@ TEST test_locking(void)
     ASSERT_EQ(1, test_lock_entry_count);
     ASSERT_EQ(1, test_lock_exit_count);
     ptr = heaps_realloc(ptr, 200);
+#ifdef HEAPS_SHARDS
+    test_lock_entry_count--;    // the old shard is locked to unlink, then the new one to link
+    test_lock_exit_count--;
+#endif
     ASSERT_EQ(2, test_lock_entry_count);
     ASSERT_EQ(2, test_lock_exit_count);
     heaps_free(ptr);
@@ -386,4 +1116,635 @@ TEST test_locking(void)
     ASSERT_EQ(4, test_lock_exit_count);
     heaps_free(ptr);
     PASS();
-}
\ No newline at end of file
+#endif
+}
+
+TEST test_per_thread(void)
+{
+#ifndef HEAPS_PER_THREAD
+    SKIPm("requires HEAPS_PER_THREAD");
+#else
+    pthread_t thread;
+    per_thread_t other = {0};
+    heaps_report_t* arr;
+    int arr_size;
+    int count = heaps_get_allocation_count();
+    void* owner;
+    char* ptr;
+    int i;
+    static heaps_t bogus[4];
+
+    // an allocation made here and freed by another thread stops being counted straight away
+    other.to_free = heaps_alloc_(40, "this thread", 4001);
+    ASSERT_EQ(0, pthread_create(&thread, NULL, per_thread_main, &other));
+    pthread_join(thread, NULL);
+    ASSERT(other.allocated != NULL);
+    ASSERT_EQ(count+1, other.count);
+    ASSERT_EQ(count+1, heaps_get_allocation_count());
+
+    // the other thread has exited, but it's allocation is still reported
+    arr = heaps_report(&arr_size);
+    ASSERT_EQ(2, arr_size);    // the other thread's allocation, and the report itself
+    for(i=0; i!=arr_size && arr[i].line != 4000; i++);
+    ASSERT(i != arr_size);
+    ASSERT_STR_EQ("other thread", arr[i].file);
+    heaps_free(arr);
+
+    // freeing it here queues it on the exited thread's list, a second free is caught before that list is emptied
+    owner = find_meta(other.allocated)->owner;
+    heaps_free(other.allocated);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    heaps_free_(other.allocated, "second free", 4002);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_STR_EQ("second free", err_info.file);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    arr = heaps_report(&arr_size);
+    for(i=0; i!=arr_size && arr[i].line != 4000; i++);
+    ASSERT_EQ(arr_size, i);
+    heaps_free(arr);
+
+    // the next thread takes over the exited thread's list, and it's allocation is copied when reallocated here
+    other = (per_thread_t){0};
+    ASSERT_EQ(0, pthread_create(&thread, NULL, per_thread_main, &other));
+    pthread_join(thread, NULL);
+    ASSERT(other.allocated != NULL);
+    ASSERT_EQ(owner, find_meta(other.allocated)->owner);
+    ptr = heaps_realloc(other.allocated, 100);
+    ASSERT(ptr != other.allocated);
+    ASSERT(find_meta(ptr)->owner != owner);
+    for(i=0; i!=50 && ptr[i] == (char)i; i++);
+    ASSERT_EQ(50, i);
+    ASSERT_EQ(count+1, heaps_get_allocation_count());
+    heaps_free(ptr);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+
+    // a thread which has never allocated has no list, freeing a pointer which isn't another thread's is a false free
+    ASSERT_EQ(0, pthread_create(&thread, NULL, bogus_free_thread_main, &bogus[2]));
+    pthread_join(thread, NULL);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_STR_EQ("bogus free", err_info.file);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    PASS();
+#endif
+}
+
+TEST test_instances(void)
+{
+#ifndef HEAPS_INSTANCES
+    SKIPm("requires HEAPS_INSTANCES");
+#else
+    int locks = 0;
+    heaps_backend_t backend = {.context = &locks, .alloc = instance_alloc, .realloc = instance_realloc, .free = instance_free, .lock = instance_lock, .unlock = instance_unlock};
+    heaps_instance_t* inst = heaps_instance_create(&backend);
+    heaps_report_t* arr;
+    int arr_size;
+    int count = heaps_get_allocation_count();
+    char* ptr1;
+    char* ptr2;
+
+    ASSERT(inst != NULL);
+    ASSERT(inst != heaps_default_instance());
+    ASSERT_EQ(0, heaps_instance_get_allocation_count(inst));
+
+    // allocations on the instance are only counted by the instance
+    ptr1 = heaps_instance_alloc_(inst, 100, "instance", 5000);
+    ptr2 = heaps_instance_calloc(inst, 10, 10);
+    ASSERT(ptr1 != NULL && ptr2 != NULL);
+    ASSERT_EQ(2, heaps_instance_get_allocation_count(inst));
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_EQ(count, heaps_instance_get_allocation_count(heaps_default_instance()));
+    ASSERT_EQ(100, heaps_instance_get_largest_allocation(inst).size);
+    ASSERT_EQ(5000, heaps_instance_get_largest_allocation(inst).line);
+
+    ptr1 = heaps_instance_realloc(inst, ptr1, 300);
+    ASSERT(ptr1 != NULL);
+    ASSERT_EQ(300, heaps_instance_get_largest_allocation(inst).size);
+    ASSERT_EQ(2, heaps_instance_get_allocation_count(inst));
+
+    // the report is allocated from, and included in, the instance
+    arr = heaps_instance_report(inst, &arr_size);
+    ASSERT(arr != NULL);
+    ASSERT_EQ(3, arr_size);
+    ASSERT_EQ(3, heaps_instance_get_allocation_count(inst));
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    heaps_instance_free(inst, arr);
+
+    // an instance can't be destroyed while it has allocations
+    ASSERT_FALSE(heaps_instance_destroy(inst));
+    heaps_instance_free(inst, ptr1);
+    heaps_instance_free(inst, ptr2);
+    ASSERT_EQ(0, heaps_instance_get_allocation_count(inst));
+    ASSERT_EQ(3, heaps_instance_get_allocation_count_peak(inst));
+#ifndef HEAPS_SHARDS
+    ASSERT(locks > 0);
+#endif
+    ASSERT(heaps_instance_destroy(inst));
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+TEST test_batch(void)
+{
+    size_t sizes[5] = {10, 20, 300, 40, 50};
+    void* ptrs[5];
+    int count = heaps_get_allocation_count();
+    int i;
+
+    test_lock_entry_count = 0;
+    test_lock_exit_count = 0;
+    ASSERT_EQ(5, heaps_alloc_batch(sizes, 5, ptrs));
+#if (!defined HEAPS_SHARDS && !defined HEAPS_PER_THREAD)
+    ASSERT_EQ(1, test_lock_entry_count);
+    ASSERT_EQ(1, test_lock_exit_count);
+#endif
+    ASSERT_EQ(count+5, heaps_get_allocation_count());
+    for(i=0; i!=5; i++)
+    {
+        ASSERT(ptrs[i] != NULL);
+        memset(ptrs[i], i, sizes[i]);
+    };
+    ASSERT(heaps_get_largest_allocation().size >= 300);
+
+    // NULLs are skipped
+    heaps_free(ptrs[1]);
+    ptrs[1] = NULL;
+    heaps_free_batch(ptrs, 5);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+
+    // a failure stops the batch, keeping the allocations already made
+    sizes[2] = MCHEAP_SIZE+1;
+    ASSERT_EQ(2, heaps_alloc_batch_(sizes, 5, ptrs, "batch", 6000));
+    ASSERT_STR_EQ("allocation failed", err_info.msg);
+    ASSERT_EQ(6000, err_info.line);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    ASSERT(ptrs[0] != NULL && ptrs[1] != NULL);
+    ASSERT(ptrs[2] == NULL && ptrs[3] == NULL && ptrs[4] == NULL);
+    ASSERT_EQ(count+2, heaps_get_allocation_count());
+    heaps_free_batch(ptrs, 5);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+}
+
+TEST test_stats(void)
+{
+    heaps_stats_t before = heaps_get_stats();
+    heaps_stats_t stats;
+    heaps_stats_t reported_stats;
+    heaps_report_t* arr;
+    int arr_size;
+    size_t reported = 0;
+    void* p[3];
+    int i;
+
+    p[0] = heaps_alloc(1);
+    p[1] = heaps_alloc(100);
+    p[2] = heaps_alloc(4096);
+    stats = heaps_get_stats();
+    ASSERT_EQ(before.bytes + 4197, stats.bytes);
+    ASSERT(stats.bytes_peak >= stats.bytes);
+    ASSERT_EQ(before.alloc_total + 3, stats.alloc_total);
+    ASSERT_EQ(before.free_total, stats.free_total);
+    ASSERT_EQ(before.histogram[1] + 1, stats.histogram[1]);
+    ASSERT_EQ(before.histogram[7] + 1, stats.histogram[7]);
+    ASSERT_EQ(before.histogram[13] + 1, stats.histogram[13]);
+
+    // the bytes in use are the total of a report, less the report itself
+    arr = heaps_report(&arr_size);
+    for(i=0; i!=arr_size; i++)
+        reported += arr[i].size;
+    ASSERT_EQ(heaps_get_stats().bytes, reported);
+    heaps_free(arr);
+
+    // a reallocation is a free and an allocation (counted from after the report, which may have been allocated more than once)
+    reported_stats = heaps_get_stats();
+    p[1] = heaps_realloc(p[1], 200);
+    stats = heaps_get_stats();
+    ASSERT_EQ(before.bytes + 4297, stats.bytes);
+    ASSERT_EQ(reported_stats.alloc_total + 1, stats.alloc_total);
+    ASSERT_EQ(reported_stats.free_total + 1, stats.free_total);
+    ASSERT_EQ(before.histogram[7], stats.histogram[7]);
+    ASSERT_EQ(before.histogram[8] + 1, stats.histogram[8]);
+
+    for(i=0; i!=3; i++)
+        heaps_free(p[i]);
+    stats = heaps_get_stats();
+    ASSERT_EQ(before.bytes, stats.bytes);
+    ASSERT(stats.bytes_peak >= before.bytes + 4297);
+    ASSERT_EQ(stats.alloc_total - before.alloc_total, stats.free_total - before.free_total);
+    ASSERT_MEM_EQ(before.histogram, stats.histogram, sizeof(stats.histogram));
+    PASS();
+}
+
+TEST test_arena(void)
+{
+    static heaps_report_t buf[32];
+    heaps_arena_t* arena;
+    heaps_report_t report;
+    heaps_report_t* arr;
+    int arr_size;
+    int count = heaps_get_allocation_count();
+    int chunks;
+    char* p[20];
+    char* big;
+    int i;
+
+    arena = heaps_arena_create_(256, "arena", 8000);
+    ASSERT(arena != NULL);
+    for(i=0; i!=20; i++)
+    {
+        p[i] = heaps_arena_alloc(arena, 21);
+        ASSERT(p[i] != NULL);
+        ASSERT_EQ(0, (uintptr_t)p[i] % __alignof__(heaps_t));
+        memset(p[i], i, 21);
+    };
+    for(i=0; i!=20 && p[i][0] == i && p[i][20] == i; i++);
+    ASSERT_EQ(20, i);
+
+    report = heaps_arena_report(arena);
+    ASSERT_STR_EQ("arena", report.file);
+    ASSERT_EQ(8000, report.line);
+    ASSERT_EQ(20, report.count);
+    ASSERT_EQ(20*21, report.size);
+
+    // the arena and it's chunks are the only allocations made, and are reported at the line which created it
+    chunks = heaps_get_allocation_count() - count - 1;
+    ASSERT(chunks >= 2);
+    arr = heaps_report(&arr_size);
+    for(i=0; i!=arr_size && arr[i].line != 8000; i++);
+    ASSERT(i != arr_size);
+    ASSERT(report_count_is(&arr[i], chunks+1));
+    ASSERT_EQ(20, arr[i].arena_count);
+    ASSERT_EQ(20*21, arr[i].arena_size);
+    heaps_free(arr);
+
+    // an allocation larger than a chunk gets one of it's own, and the current chunk is still used
+    big = heaps_arena_alloc(arena, 1000);
+    ASSERT(big != NULL);
+    memset(big, 0xAA, 1000);
+    ASSERT_EQ(count+chunks+2, heaps_get_allocation_count());
+    ASSERT(heaps_arena_alloc(arena, 8) != NULL);
+    ASSERT_EQ(count+chunks+2, heaps_get_allocation_count());
+    ASSERT_EQ(22, heaps_arena_report(arena).count);
+
+    heaps_arena_destroy(arena);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+
+    // an allocation of 0 bytes gets it's own pointer, from a new arena as well as from one with a chunk
+    arena = heaps_arena_create_(256, "arena", 8001);
+    p[0] = heaps_arena_alloc(arena, 0);
+    p[1] = heaps_arena_alloc(arena, 0);
+    ASSERT(p[0] != NULL);
+    ASSERT(p[1] != NULL);
+    ASSERT(p[0] != p[1]);
+    report = heaps_arena_report(arena);
+    ASSERT_EQ(2, report.count);
+    ASSERT_EQ(0, report.size);
+    heaps_report_into(buf, 32, &arr_size);
+    for(i=0; i!=arr_size && buf[i].line != 8001; i++);
+    ASSERT(i != arr_size);
+    ASSERT_EQ(2, buf[i].arena_count);
+    heaps_arena_destroy(arena);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+}
+
+TEST test_arena_too_large(void)
+{
+    heaps_arena_t* arena;
+    int count = heaps_get_allocation_count();
+    size_t size;
+
+    // sizes which would wrap when rounded up fail, and don't take from the arena's chunk
+    arena = heaps_arena_create_(256, "arena", 8002);
+    ASSERT(heaps_arena_alloc(arena, 8) != NULL);
+    for(size = SIZE_MAX; size != SIZE_MAX - 2*__alignof__(heaps_t) + 1; size--)
+    {
+        ASSERT_EQ(NULL, heaps_arena_alloc(arena, size));
+        ASSERT_STR_EQ("allocation failed", err_info.msg);
+        ASSERT_STR_EQ("arena", err_info.file);
+        ASSERT_EQ(8002, err_info.line);
+        err_info = (err_info_t){.file ="", .line=0, .msg=""};
+    };
+    ASSERT_EQ(1, heaps_arena_report(arena).count);
+    ASSERT_EQ(8, heaps_arena_report(arena).size);
+    heaps_arena_destroy(arena);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    PASS();
+}
+
+TEST test_sampling(void)
+{
+#ifndef HEAPS_SAMPLING
+    SKIPm("requires HEAPS_SAMPLING");
+#else
+    static char* ptrs[2000];
+    static heaps_report_t buf[32];
+    static report_copy_t copy;
+    heaps_report_t* arr;
+    int arr_size;
+    int count = heaps_get_allocation_count();
+    int sampled = 0;
+    heaps_t* link;
+    char* a;
+    int i;
+
+    heaps_set_sampling_interval(4096);
+    ASSERT_EQ(4096, heaps_get_sampling_interval());
+    for(i=0; i!=2000; i++)
+    {
+        ptrs[i] = heaps_alloc_(64, "sampling", 9000);
+        ASSERT(ptrs[i] != NULL);
+        memset(ptrs[i], i, 64);
+    };
+    ASSERT_EQ(count+2000, heaps_get_allocation_count());
+
+    // about 1 in 64 is sampled and linked
+    for(link = heaps_get_allocation_list(); link; link = heaps_get_next_allocation(link))
+        sampled += (heaps_line_of(link) == 9000);
+    ASSERT(sampled > 0 && sampled < 200);
+
+    // the report estimates all of them
+    arr = heaps_report(&arr_size);
+    for(i=0; i!=arr_size && arr[i].line != 9000; i++);
+    ASSERT(i != arr_size);
+    ASSERT(arr[i].count_error > 0);
+    ASSERT(arr[i].count > 2000 - arr[i].count_error && arr[i].count < 2000 + arr[i].count_error);
+    ASSERT(arr[i].size > 2000*64 - arr[i].size_error && arr[i].size < 2000*64 + arr[i].size_error);
+    ASSERT(arr[i].size >= (size_t)arr[i].count*63 && arr[i].size <= (size_t)arr[i].count*65);
+    heaps_free(arr);
+
+    // as do the reports into a buffer, and to a callback
+    heaps_report_into(buf, 32, &arr_size);
+    for(i=0; i!=arr_size && buf[i].line != 9000; i++);
+    ASSERT(i != arr_size);
+    ASSERT(report_count_is(&buf[i], 2000));
+    ASSERT(report_size_is(&buf[i], 2000*64));
+    copy.size = 0;
+    heaps_report_foreach(report_copy, &copy);
+    for(i=0; i!=copy.size && copy.entries[i].line != 9000; i++);
+    ASSERT(i != copy.size);
+    ASSERT(report_count_is(&copy.entries[i], 2000));
+    ASSERT(report_size_is(&copy.entries[i], 2000*64));
+
+    // unsampled and sampled allocations are resized, freed, and caught being freed twice alike
+    for(i=0; i!=2000; i++)
+    {
+        ptrs[i] = heaps_realloc(ptrs[i], 100);
+        ASSERT(ptrs[i] != NULL);
+        ASSERT_EQ((char)i, ptrs[i][63]);
+    };
+    ASSERT_EQ(count+2000, heaps_get_allocation_count());
+    a = ptrs[0];
+    heaps_free_batch((void**)ptrs, 2000);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    heaps_free_(a, "sampling double free", 9001);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_EQ(9001, err_info.line);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+
+    // calloc and realloc from NULL may be unsampled too
+    for(i=0; i!=100; i++)
+    {
+        ptrs[i] = heaps_calloc(8, 8);
+        ASSERT(ptrs[i] != NULL && ptrs[i][63] == 0);
+        ptrs[i+100] = heaps_realloc(NULL, 64);
+        ASSERT(ptrs[i+100] != NULL);
+    };
+    for(i=0; i!=200; i++)
+        heaps_free(ptrs[i]);
+    ASSERT_EQ(count, heaps_get_allocation_count());
+
+    heaps_set_sampling_interval(0);
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+TEST test_slab(void)
+{
+#ifndef HEAPS_SLAB
+    SKIPm("requires HEAPS_SLAB");
+#else
+    heaps_report_t* arr;
+    int arr_size;
+    int count = heaps_get_allocation_count();
+    char* a;
+    char* b;
+    int i;
+
+    // 40 and 44 bytes (plus any size of heaps_t) are in the same class, so a freed block is reused, and can grow in place
+    a = heaps_alloc_(40, "slab", 7000);
+    ASSERT(a != NULL);
+    heaps_free(a);
+    b = heaps_alloc_(44, "slab", 7001);
+    ASSERT_EQ(a, b);
+
+    // the block is still attributed to it's file:line
+    arr = heaps_report(&arr_size);
+    for(i=0; i!=arr_size && arr[i].line != 7001; i++);
+    ASSERT(i != arr_size);
+    ASSERT_STR_EQ("slab", arr[i].file);
+    ASSERT_EQ(1, arr[i].count);
+    ASSERT_EQ(44, arr[i].size);
+    heaps_free(arr);
+
+    ASSERT_EQ(b, heaps_realloc(b, 40));
+    ASSERT_EQ(b, heaps_realloc(b, 44));
+
+    // moving between classes, and to and from the platform allocator, keeps the content
+    for(i=0; i!=44; i++)
+        b[i] = i;
+    b = heaps_realloc(b, 300);
+    ASSERT(b != a);
+    b = heaps_realloc(b, 5000);
+    b = heaps_realloc(b, 20);
+    for(i=0; i!=20 && b[i] == i; i++);
+    ASSERT_EQ(20, i);
+    heaps_free(b);
+
+    // a double free is still caught, while the block is in it's class's free list
+    a = heaps_alloc(44);
+    heaps_free(a);
+    heaps_free_(a, "slab double free", 7002);
+    ASSERT_STR_EQ("false free", err_info.msg);
+    ASSERT_EQ(7002, err_info.line);
+    err_info = (err_info_t){.file ="", .line=0, .msg=""};
+
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+TEST test_thread_cache(void)
+{
+#ifndef HEAPS_THREAD_CACHE
+    SKIPm("requires HEAPS_THREAD_CACHE");
+#else
+    void* ptrs[HEAPS_THREAD_CACHE+2];
+    pthread_t thread;
+    size_t hits;
+    size_t misses;
+    int count = heaps_get_allocation_count();
+    void* a;
+    void* b;
+    int i;
+
+    heaps_cache_flush();
+    hits = heaps_get_cache_hit_count();
+    misses = heaps_get_cache_miss_count();
+
+    // a freed block is reused for the next allocation of it's class
+    a = heaps_alloc(40);
+    heaps_free(a);
+    b = heaps_alloc(44);
+    ASSERT_EQ(a, b);
+    heaps_free(b);
+    heaps_cache_flush();
+    ASSERT_EQ(hits+1, heaps_get_cache_hit_count());
+    ASSERT_EQ(misses+1, heaps_get_cache_miss_count());
+
+    // each magazine holds at most HEAPS_THREAD_CACHE blocks
+    for(i=0; i!=HEAPS_THREAD_CACHE+2; i++)
+        ptrs[i] = heaps_alloc(44);
+    for(i=0; i!=HEAPS_THREAD_CACHE+2; i++)
+        heaps_free(ptrs[i]);
+    for(i=0; i!=HEAPS_THREAD_CACHE+2; i++)
+        ptrs[i] = heaps_alloc(44);
+    heaps_cache_flush();
+    ASSERT_EQ(hits+1+HEAPS_THREAD_CACHE, heaps_get_cache_hit_count());
+    ASSERT_EQ(misses+1+HEAPS_THREAD_CACHE+2+2, heaps_get_cache_miss_count());
+    for(i=0; i!=HEAPS_THREAD_CACHE+2; i++)
+        heaps_free(ptrs[i]);
+    heaps_cache_flush();
+
+    // a thread's counts are added, and it's magazines flushed, when it exits
+    hits = heaps_get_cache_hit_count();
+    misses = heaps_get_cache_miss_count();
+    ASSERT_EQ(0, pthread_create(&thread, NULL, cache_thread_main, NULL));
+    pthread_join(thread, NULL);
+    ASSERT_EQ(hits+1, heaps_get_cache_hit_count());
+    ASSERT_EQ(misses+1, heaps_get_cache_miss_count());
+
+    ASSERT_EQ(count, heaps_get_allocation_count());
+    ASSERT_STR_EQ("", err_info.msg);
+    PASS();
+#endif
+}
+
+static bool report_count_is(const heaps_report_t* entry, int count)
+{
+#ifdef HEAPS_SAMPLING
+    if(heaps_get_sampling_interval())
+        return entry->count >= count - entry->count_error && entry->count <= count + entry->count_error;
+#endif
+    return entry->count == count;
+}
+
+static bool report_size_is(const heaps_report_t* entry, size_t size)
+{
+#ifdef HEAPS_SAMPLING
+    if(heaps_get_sampling_interval())
+        return entry->size + entry->size_error >= size && entry->size <= size + entry->size_error;
+#endif
+    return entry->size == size;
+}
+
+static heaps_t* find_meta(void* ptr)
+{
+    heaps_t* link = heaps_get_allocation_list();
+    while(link && heaps_content_of(link) != ptr)
+        link = heaps_get_next_allocation(link);
+    return link;
+}
+
+static void* per_thread_main(void* arg)
+{
+    per_thread_t* other = arg;
+    int i;
+
+    other->allocated = heaps_alloc_(50, "other thread", 4000);
+    for(i=0; other->allocated && i!=50; i++)
+        ((char*)other->allocated)[i] = i;
+    if(other->to_free)
+        heaps_free(other->to_free);
+    other->count = heaps_get_allocation_count();
+    return NULL;
+}
+
+static void* bogus_free_thread_main(void* arg)
+{
+    heaps_free_(arg, "bogus free", 4003);
+    return NULL;
+}
+
+static void* cache_thread_main(void* arg)
+{
+    (void)arg;
+    heaps_free(heaps_alloc(40));
+    heaps_free(heaps_alloc(44));
+    return NULL;
+}
+
+static void* snapshot_thread_main(void* arg)
+{
+    void* ptrs[16];
+    int i;
+
+    while(!__atomic_load_n((bool*)arg, __ATOMIC_ACQUIRE))
+    {
+        for(i=0; i!=16; i++)
+            ptrs[i] = heaps_alloc_(24, "snapshot", 3300);
+        for(i=0; i!=16; i++)
+            heaps_free(ptrs[i]);
+    };
+    return NULL;
+}
+
+static void* trace_thread_main(void* arg)
+{
+    (void)arg;
+    heaps_free(heaps_alloc_(50, "trace", 6010));
+    return NULL;
+}
+
+static void report_copy(const heaps_report_t* entry, void* context)
+{
+    report_copy_t* copy = context;
+    if(copy->size != 32)
+        copy->entries[copy->size++] = *entry;
+}
+
+static void* instance_alloc(void* context, size_t size)
+{
+    (void)context;
+    return malloc(size);
+}
+
+static void* instance_realloc(void* context, void* ptr, size_t size)
+{
+    (void)context;
+    return realloc(ptr, size);
+}
+
+static void instance_free(void* context, void* ptr)
+{
+    (void)context;
+    free(ptr);
+}
+
+static void instance_lock(void* context)
+{
+    (*(int*)context)++;
+}
+
+static void instance_unlock(void* context)
+{
+    (void)context;
+}